@@ -2,38 +2,167 @@
 
 #include <mutex>
 #include <memory>
-#include <future>
+#include <chrono>
+#include <cstdint>
+#include <limits>
 #include <deque>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 
 #include "IConsumer.h"
 #include "IValueSource.h"
+#include "Instrumentation.h"
+#include "Stats.h"
+#include "Task.h"
+#include "Tracer.h"
 
 namespace MQP
 {
 
+/// <summary>
+/// ConsumerProcessor's settings
+/// </summary>
+struct ConsumerProcessorSettings
+{
+   // max count of consumer calls (a value or a batch of values, see IBatchConsumer) for one value source which are made 
+   // by a single thread pool task, then the value source is rescheduled to the end of the processing order (keys fairness)
+   std::size_t drainQuantumCount = 1;
+   // max time which a single thread pool task spends for consuming values of one value source, zero means no limit
+   std::chrono::nanoseconds drainQuantumTime = std::chrono::nanoseconds::zero();
+   // max count of values passed to IBatchConsumer::ConsumeBatch at once
+   std::size_t maxBatchSize = std::numeric_limits<std::size_t>::max();
+   // "caller runs" mode: a free consumer is notified right in the enqueuing thread (up to a drain quantum),
+   // the thread pool is used only if the consumer is busy or has more values after that.
+   // A consumer is not bound to a thread pool's thread in the mode (see ThreadPoolSticky).
+   bool isInlineDispatchEnabled = false;
+   // max nesting of inline notifications in a thread (a consumer can enqueue values for other consumers),
+   // a deeper notification is passed to the thread pool
+   std::size_t maxInlineDispatchDepth = 1;
+};
+
+/// <summary>
+/// Makes the token which ConsumerProcessor passes to the thread pool with the consumer's tasks
+/// (e.g. to bind the consumer to a ThreadPoolSticky's workers group).
+/// The token is the address of the consumer's most derived object, so it is the same for a pointer to any of its classes.
+/// </summary>
+template<typename Consumer>
+std::uintptr_t MakeConsumerToken(const std::shared_ptr<Consumer>& consumer)
+{
+   return reinterpret_cast<std::uintptr_t>(dynamic_cast<const void*>(consumer.get()));
+}
+
+namespace details
+{
+
+/// <summary>
+/// The nesting of inline consumer notifications in the current thread
+/// </summary>
+inline std::size_t& InlineDispatchDepth()
+{
+   thread_local std::size_t depth = 0;
+   return depth;
+}
+
+}
+
 /// <summary>
 /// The class is responsible for one consumer notifying by means of tasks that are passed to a thread pool.
 /// Also, the class controls that only one task is processed in the thread pool for the consumer at a time.
+/// A value source is scheduled for processing at most once regardless of the notifications count, after a value
+/// consuming it is rescheduled to the end of the processing order while it has values, so one notification can
+/// announce any count of new values.
+/// A task consumes up to a drain quantum of values (see ConsumerProcessorSettings) of one value source,
+/// so a hot value source costs one thread pool round-trip per quantum rather than per value.
+/// An IBatchConsumer gets all values of a value source which are available in a row of its storage by a single call.
+/// A free consumer can be notified right in the enqueuing thread (see ConsumerProcessorSettings::isInlineDispatchEnabled).
+/// With LatencyInstrumentation the value sources keep stamped values and each consumer call records latencies per key.
+/// TTracer (see Tracer.h) traces the notifications, the tasks (a flow links a task's posting with its start) and the consumer calls,
+/// the trace events' id is the consumer's token.
 /// </summary>
-template<typename Key, typename Value, typename TPool, typename Hash>
-class ConsumerProcessor final : public IValueSourceConsumer<Key, Value>
-                              , public std::enable_shared_from_this<ConsumerProcessor<Key, Value, TPool, Hash>>
+template<typename Key, typename Value, typename TPool, typename Hash, typename TInstrumentation = NoInstrumentation, typename TTracer = NoTracer>
+class ConsumerProcessor final : public std::enable_shared_from_this<ConsumerProcessor<Key, Value, TPool, Hash, TInstrumentation, TTracer>>
 {
    enum class EState { free, processing };
+
+   using StoredValue = typename TInstrumentation::template StoredValue<Value>;
+
+   /// <summary>
+   /// The consumer of one value source, it passes the source's notifications to the processor and keeps the source's
+   /// scheduling state, so the processor tracks the scheduled value sources without a lookup or an allocation
+   /// </summary>
+   class ValueSourceNode final : public IValueSourceConsumer<Key, StoredValue>, public std::enable_shared_from_this<ValueSourceNode>
+   {
+   public:
+      explicit ValueSourceNode(std::weak_ptr<ConsumerProcessor> processor) : m_processor(std::move(processor))
+      {}
+
+      void OnNewValueAvailable(IValueSourcePtr<Key, StoredValue> valueSource) override
+      {
+         if (auto spProcessor = m_processor.lock())
+         {
+            spProcessor->onNewValueAvailable(*this, std::move(valueSource));
+         }
+      }
+
+   private:
+      friend ConsumerProcessor;
+
+      const std::weak_ptr<ConsumerProcessor> m_processor;
+      // the fields are guarded by the processor's m_mutex, the value source is set when it is scheduled
+      // and is read by its task while it stays scheduled (queued for processing or being processed)
+      bool m_isScheduled = false;
+      IValueSourceWeakPtr<Key, StoredValue> m_valueSource;
+   };
+
+   using ValueSourceNodePtr = std::shared_ptr<ValueSourceNode>;
+
+   /// <summary>
+   /// A consumer's subscription to a key: the key's value source and the node which the source notifies
+   /// </summary>
+   struct Subscription
+   {
+      IValueSourcePtr<Key, StoredValue> valueSource;
+      IValueSourceConsumerPtr<Key, StoredValue> valueSourceConsumer;
+   };
+
+   /// <summary>
+   /// Latency histograms of the consumer's keys, they are recorded by the consumer's tasks and read by snapshots
+   /// </summary>
+   struct KeysLatencyHistograms
+   {
+      std::mutex mutex; // guards histograms
+      std::unordered_map<Key, LatencyHistograms, Hash> histograms;
+   };
+
+   struct NoLatencyHistograms
+   {};
+
 public:
-   ConsumerProcessor(IConsumerPtr<Key, Value> consumer, std::shared_ptr<TPool> threadPool) 
+   ConsumerProcessor(IConsumerPtr<Key, Value> consumer, std::shared_ptr<TPool> threadPool, const ConsumerProcessorSettings& settings = {}) 
       : m_consumer(std::move(consumer))
-      , m_token(reinterpret_cast<std::uintptr_t>(m_consumer.get()))
+      , m_batchConsumer(dynamic_cast<IBatchConsumer<Key, Value>*>(m_consumer.get()))
+      , m_token(MakeConsumerToken(m_consumer))
+      , m_settings(settings)
       , m_threadPool(std::move(threadPool))
    {
+      if (m_settings.drainQuantumCount == 0)
+      {
+         m_settings.drainQuantumCount = 1;
+      }
+
+      if (m_settings.maxBatchSize == 0)
+      {
+         m_settings.maxBatchSize = 1;
+      }
    }
 
    ~ConsumerProcessor()
    {
       std::scoped_lock lock(m_valueSourceMutex);
-      for (auto& [key, valueSource] : m_valueSources)
+      for (auto& [key, subscription] : m_valueSources)
       {
-         valueSource->Stop();
+         subscription.valueSource->Stop();
       }
    }
 
@@ -42,16 +171,25 @@ public:
    ConsumerProcessor(ConsumerProcessor&&) = delete;
    ConsumerProcessor& operator=(ConsumerProcessor&&) = delete;
 
+   /// <summary>
+   /// Creates the consumer which a new value source notifies, it is kept with the source (see AddValueSource)
+   /// </summary>
+   IValueSourceConsumerPtr<Key, StoredValue> CreateValueSourceConsumer()
+   {
+      return std::make_shared<ValueSourceNode>(weak_from_this());
+   }
+
    /// <summary>
    /// Adds a value source to consumer processor
    /// </summary>
    /// <param name="key">A key for which a processed consumer needs data.</param>
    /// <param name="valueSource">A value source which provides data for the passed key.</param>
-   void AddValueSource(const Key& key, IValueSourcePtr<Key, Value> valueSource)
+   /// <param name="valueSourceConsumer">The value source's consumer (see CreateValueSourceConsumer).</param>
+   void AddValueSource(const Key& key, IValueSourcePtr<Key, StoredValue> valueSource, IValueSourceConsumerPtr<Key, StoredValue> valueSourceConsumer)
    {
       std::scoped_lock lock(m_valueSourceMutex);
 
-      m_valueSources.try_emplace(key, std::move(valueSource));
+      m_valueSources.try_emplace(key, Subscription{ std::move(valueSource), std::move(valueSourceConsumer) });
    }
 
    /// <summary>
@@ -59,7 +197,7 @@ public:
    /// </summary>
    void RemoveSubscription(const Key& key)
    {
-      IValueSourcePtr<Key, Value> valueSource;
+      IValueSourcePtr<Key, StoredValue> valueSource;
 
       {
          std::scoped_lock lock(m_valueSourceMutex);
@@ -70,11 +208,17 @@ public:
             return;
          }
 
-         valueSource = std::move(it->second);
+         valueSource = std::move(it->second.valueSource);
          m_valueSources.erase(it);
       }
 
       valueSource->Stop();
+
+      if constexpr (TInstrumentation::isEnabled)
+      {
+         std::scoped_lock lock(m_latencyHistograms.mutex);
+         m_latencyHistograms.histograms.erase(key);
+      }
    }
 
    bool IsSubscribedToAny() const
@@ -89,16 +233,74 @@ public:
       return m_consumer;
    }
 
+   /// <summary>
+   /// Gets the consumer's statistics. The value sources are queried out of the processor's locks.
+   /// </summary>
+   ConsumerStats<Key, Value> GetStats() const
+   {
+      ConsumerStats<Key, Value> stats;
+      stats.consumer = m_consumer;
+
+      {
+         std::scoped_lock lock(m_mutex);
+
+         stats.isProcessing = (m_state == EState::processing);
+         stats.pendingSourcesCount = m_valueSourceProcessingOrder.size();
+      }
+
+      std::vector<std::tuple<Key, IValueSourcePtr<Key, StoredValue>>> valueSources;
+
+      {
+         std::scoped_lock lock(m_valueSourceMutex);
+
+         valueSources.reserve(m_valueSources.size());
+         for (const auto& [key, subscription] : m_valueSources)
+         {
+            valueSources.emplace_back(key, subscription.valueSource);
+         }
+      }
+
+      stats.lags.reserve(valueSources.size());
+      for (const auto& [key, valueSource] : valueSources)
+      {
+         stats.lags.emplace_back(key, valueSource->GetLag());
+      }
+
+      return stats;
+   }
+
+   /// <summary>
+   /// Passes the latency histograms of each consumer's key to the function, LatencyInstrumentation is required
+   /// </summary>
+   /// <param name="function">A function(const Key&, const LatencyHistograms&)</param>
+   /// <param name="isResetRequested">Whether the histograms are reset after the function calls</param>
+   template <typename Function>
+   void VisitLatencyHistograms(Function&& function, bool isResetRequested)
+   {
+      static_assert(TInstrumentation::isEnabled, "The latency histograms require LatencyInstrumentation");
+
+      std::scoped_lock lock(m_latencyHistograms.mutex);
+      for (auto& [key, histograms] : m_latencyHistograms.histograms)
+      {
+         function(key, static_cast<const LatencyHistograms&>(histograms));
+         if (isResetRequested)
+         {
+            histograms.Reset();
+         }
+      }
+   }
+
 private:
 
-   using std::enable_shared_from_this<ConsumerProcessor<Key, Value, TPool, Hash>>::weak_from_this;
+   using std::enable_shared_from_this<ConsumerProcessor<Key, Value, TPool, Hash, TInstrumentation, TTracer>>::weak_from_this;
 
    /// <summary>
    /// Creates a consumer notification task for passing it to the thread pool.
+   /// The task's captures fit Task's inline buffer, so no heap allocation is done.
    /// </summary>
-   std::packaged_task<void()> createTask(IValueSourceWeakPtr<Key, Value> valueSource)
+   Task createTask(ValueSourceNodePtr valueSourceNode)
    {
-      return std::packaged_task<void()>([processor = weak_from_this(), valueSource = valueSource]()
+      return Task([processor = weak_from_this(), valueSourceNode = std::move(valueSourceNode)]()
       {
          auto spProcessor = processor.lock();
          if (!spProcessor)
@@ -106,92 +308,251 @@ private:
             return;
          }
 
-         if (auto spValueSource = valueSource.lock())
+         TTracer::FlowFinish("ConsumerProcessor::task", spProcessor->m_token);
+         details::TraceScope<TTracer> trace("ConsumerProcessor::task", spProcessor->m_token);
+
+         if (auto spValueSource = valueSourceNode->m_valueSource.lock())
+         {
+            spProcessor->drain(*spValueSource);
+         }
+
+         spProcessor->onValueProcessed(valueSourceNode);
+      });
+   }
+
+   /// <summary>
+   /// Consumes values of the value source till it runs out of values or the drain quantum is exhausted.
+   /// A batch consumer gets the values by batches.
+   /// </summary>
+   void drain(IValueSource<Key, StoredValue>& valueSource)
+   {
+      if (valueSource.IsStopped() || !valueSource.HasValue())
+      {
+         return;
+      }
+
+      const bool isTimeLimited = m_settings.drainQuantumTime != std::chrono::nanoseconds::zero();
+      const auto deadline = isTimeLimited ? std::chrono::steady_clock::now() + m_settings.drainQuantumTime 
+                                          : std::chrono::steady_clock::time_point::max();
+
+      for (std::size_t calls = 1; ; ++calls)
+      {
+         bool hasValue = false;
+
+         if (m_batchConsumer)
+         {
+            const auto& [key, values] = valueSource.GetValues(m_settings.maxBatchSize);
+            details::TraceScope<TTracer> trace("IBatchConsumer::ConsumeBatch", m_token);
+            if constexpr (TInstrumentation::isEnabled)
+            {
+               // the consumer sees the values only, they are a field of the stamped values
+               const auto dispatchTime = std::chrono::steady_clock::now();
+               m_batchConsumer->ConsumeBatch(key, ValuesView<Value>(&values.data()->value, values.size(), values.stride()));
+               recordLatencies(key, values, dispatchTime);
+            }
+            else
+            {
+               m_batchConsumer->ConsumeBatch(key, values);
+            }
+
+            hasValue = valueSource.MoveNext(values.size());
+         }
+         else
          {
-            if (!spValueSource->IsStopped() && spValueSource->HasValue())
+            const auto& [key, value] = valueSource.GetValue();
+            details::TraceScope<TTracer> trace("IConsumer::Consume", m_token);
+            if constexpr (TInstrumentation::isEnabled)
             {
-               const auto& [key, value] = spValueSource->GetValue();
-               spProcessor->GetConsumer()->Consume(key, value);
-               spValueSource->MoveNext();
+               const auto dispatchTime = std::chrono::steady_clock::now();
+               m_consumer->Consume(key, value.value);
+               recordLatencies(key, ValuesView<StoredValue>(&value, 1), dispatchTime);
             }
+            else
+            {
+               m_consumer->Consume(key, value);
+            }
+
+            hasValue = valueSource.MoveNext();
          }
 
-         spProcessor->onValueProcessed();
-      });
+         if (!hasValue || calls == m_settings.drainQuantumCount || valueSource.IsStopped())
+         {
+            return;
+         }
+
+         if (isTimeLimited && std::chrono::steady_clock::now() >= deadline)
+         {
+            return;
+         }
+      }
+   }
+
+   /// <summary>
+   /// Records latencies of the stamped values which have been consumed by a call started at the dispatch time
+   /// </summary>
+   void recordLatencies(const Key& key, const ValuesView<StoredValue>& values, std::chrono::steady_clock::time_point dispatchTime)
+   {
+      const auto consumedTime = std::chrono::steady_clock::now();
+
+      std::scoped_lock lock(m_latencyHistograms.mutex);
+
+      auto& histograms = m_latencyHistograms.histograms[key];
+      histograms.dispatchToConsumed.Record(toNs(consumedTime - dispatchTime), values.size());
+      for (const auto& value : values)
+      {
+         histograms.enqueueToDispatch.Record(toNs(dispatchTime - value.enqueueTime));
+      }
+   }
+
+   static std::uint64_t toNs(std::chrono::steady_clock::duration duration)
+   {
+      const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+      return ns > 0 ? static_cast<std::uint64_t>(ns) : 0;
    }
 
    /// <summary>
    /// A consumer notification task completion handler.
    /// </summary>
-   void onValueProcessed()
+   /// <param name="processedValueSourceNode">The node of the value source which has been processed by the completed task.</param>
+   void onValueProcessed(const ValueSourceNodePtr& processedValueSourceNode)
    {
-      std::packaged_task<void()> nextTask;
+      Task nextTask;
 
       {
          std::scoped_lock lock(m_mutex);
          assert(m_state == EState::processing);
 
-         while (!m_valueSourceProcessingOrder.empty())
+         // the check is done under the lock, so a concurrent notification about a new value cannot be lost
+         auto processed = processedValueSourceNode->m_valueSource.lock();
+         if (processed && !processed->IsStopped() && processed->HasValue())
          {
-            auto nextValueSource = std::move(m_valueSourceProcessingOrder.front());
+            if (m_valueSourceProcessingOrder.empty())
+            {
+               // the only scheduled value source goes on without passing through the processing order
+               nextTask = createTask(processedValueSourceNode);
+            }
+            else
+            {
+               m_valueSourceProcessingOrder.emplace_back(processedValueSourceNode);
+            }
+         }
+         else
+         {
+            processedValueSourceNode->m_isScheduled = false;
+         }
+
+         while (!nextTask && !m_valueSourceProcessingOrder.empty())
+         {
+            auto nextValueSourceNode = std::move(m_valueSourceProcessingOrder.front());
             m_valueSourceProcessingOrder.pop_front();
 
-            auto valueSource = nextValueSource.lock();
+            auto valueSource = nextValueSourceNode->m_valueSource.lock();
             if (!valueSource || valueSource->IsStopped())
             {
+               nextValueSourceNode->m_isScheduled = false;
                continue; // skip all stopped value sources
             }
 
-            nextTask = createTask(std::move(nextValueSource));
+            nextTask = createTask(std::move(nextValueSourceNode));
             break;
          }
 
-         if (!nextTask.valid() && m_valueSourceProcessingOrder.empty())
+         if (!nextTask && m_valueSourceProcessingOrder.empty())
          {
             m_state = EState::free;
             return;
          }
       }
 
-      m_threadPool->Post(std::move(nextTask), m_token);
+      post(std::move(nextTask));
    }
 
    /// <summary>
-   /// A new value available in the passed value source event handler
+   /// A new value available in the passed value source event handler, the node is the value source's one
    /// </summary>
-   void OnNewValueAvailable(IValueSourcePtr<Key, Value> valueSource) override
+   void onNewValueAvailable(ValueSourceNode& valueSourceNode, IValueSourcePtr<Key, StoredValue> valueSource)
    {
-      std::packaged_task<void()> task;
+      TTracer::Instant("ConsumerProcessor::OnNewValueAvailable", m_token);
+
+      Task task;
+      bool isInline = false;
 
       {
          std::scoped_lock lock(m_mutex);
+         if (std::exchange(valueSourceNode.m_isScheduled, true))
+         {
+            return; // the value source is already scheduled, all its values are going to be consumed
+         }
+
+         valueSourceNode.m_valueSource = valueSource;
+
          if (m_state == EState::processing)
          {
-            m_valueSourceProcessingOrder.emplace_back(std::move(valueSource));
+            m_valueSourceProcessingOrder.emplace_back(valueSourceNode.shared_from_this());
             return;
          }
 
          assert(m_state == EState::free);
          m_state = EState::processing;
 
-         task = createTask(std::move(valueSource));
+         isInline = m_settings.isInlineDispatchEnabled && details::InlineDispatchDepth() < m_settings.maxInlineDispatchDepth;
+         if (!isInline)
+         {
+            task = createTask(valueSourceNode.shared_from_this());
+         }
+      }
+
+      if (isInline)
+      {
+         dispatchInline(valueSourceNode.shared_from_this(), *valueSource);
+         return;
       }
 
+      post(std::move(task));
+   }
+
+   /// <summary>
+   /// Passes the consumer's task to the thread pool
+   /// </summary>
+   void post(Task task)
+   {
+      TTracer::FlowStart("ConsumerProcessor::task", m_token);
+
       m_threadPool->Post(std::move(task), m_token);
    }
 
+   /// <summary>
+   /// Notifies the consumer in the current thread, like a thread pool task does.
+   /// </summary>
+   void dispatchInline(const ValueSourceNodePtr& valueSourceNode, IValueSource<Key, StoredValue>& valueSource)
+   {
+      details::TraceScope<TTracer> trace("ConsumerProcessor::dispatchInline", m_token);
+
+      auto& depth = details::InlineDispatchDepth();
+
+      ++depth;
+      drain(valueSource);
+      --depth;
+
+      onValueProcessed(valueSourceNode);
+   }
+
 private:
    const IConsumerPtr<Key, Value> m_consumer;
+   IBatchConsumer<Key, Value>* const m_batchConsumer; // m_consumer in case it is a batch consumer
    // a token is requiered in case a thread pool shall notify the consumer strictly from the same thread (STA simulation)
    const std::uintptr_t m_token; 
-   std::mutex m_mutex; // guards m_state and m_valueSourceProcessingOrder
+   ConsumerProcessorSettings m_settings;
+   mutable std::mutex m_mutex; // guards m_state, m_valueSourceProcessingOrder and the value source nodes' scheduling state
    EState m_state = EState::free;
-   std::deque<IValueSourceWeakPtr<Key, Value>> m_valueSourceProcessingOrder; // keeps the calls order close to original
+   // keeps the calls order close to original, a value source which is here or is being processed by a task is marked as scheduled
+   std::deque<ValueSourceNodePtr> m_valueSourceProcessingOrder;
    mutable std::mutex m_valueSourceMutex; // guards m_valueSources
-   std::unordered_map<Key, IValueSourcePtr<Key, Value>, Hash> m_valueSources;
+   std::unordered_map<Key, Subscription, Hash> m_valueSources;
    const std::shared_ptr<TPool> m_threadPool;
+   std::conditional_t<TInstrumentation::isEnabled, KeysLatencyHistograms, NoLatencyHistograms> m_latencyHistograms;
 };
 
-template<typename Key, typename Value, typename TPool, typename Hash>
-using ConsumerProcessorPtr = std::shared_ptr<ConsumerProcessor<Key, Value, TPool, Hash>>;
+template<typename Key, typename Value, typename TPool, typename Hash, typename TInstrumentation = NoInstrumentation, typename TTracer = NoTracer>
+using ConsumerProcessorPtr = std::shared_ptr<ConsumerProcessor<Key, Value, TPool, Hash, TInstrumentation, TTracer>>;
 }
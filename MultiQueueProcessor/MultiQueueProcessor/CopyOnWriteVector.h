@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "IdlePolicy.h"
+
+namespace MQP
+{
+
+namespace details
+{
+
+/// <summary>
+/// A test-and-test-and-set spin lock for critical sections of a few instructions.
+/// A waiter yields its time slice after a short spinning, in case the owner has been preempted.
+/// </summary>
+class SpinLock
+{
+public:
+   void lock() noexcept
+   {
+      constexpr std::size_t maxSpinsCount = 64;
+
+      while (m_isLocked.exchange(true, std::memory_order_acquire))
+      {
+         for (std::size_t spins = 0; m_isLocked.load(std::memory_order_relaxed); ++spins)
+         {
+            if (spins < maxSpinsCount)
+            {
+               CpuRelax();
+            }
+            else
+            {
+               std::this_thread::yield();
+            }
+         }
+      }
+   }
+
+   void unlock() noexcept
+   {
+      m_isLocked.store(false, std::memory_order_release);
+   }
+
+private:
+   std::atomic_bool m_isLocked = false;
+};
+
+}
+
+/// <summary>
+/// A vector which is published as an immutable reference-counted snapshot (RCU-like).
+/// Reading takes the current snapshot by a single reference count increment, without copying of the items.
+/// The increment is guarded by the vector's own spin lock, so readers of different vectors (keys) never contend
+/// (std::atomic_load of a std::shared_ptr is not lock-free in common standard libraries, it locks a process-wide mutex pool).
+/// Modifications rebuild and publish a new snapshot, readers keep using the previous one safely.
+/// Modifications must be serialized by the owner.
+/// </summary>
+template <typename T>
+class CopyOnWriteVector
+{
+public:
+   using Snapshot = std::vector<T>;
+   using SnapshotPtr = std::shared_ptr<const Snapshot>;
+
+   /// <summary>
+   /// Gets the current snapshot
+   /// </summary>
+   SnapshotPtr Get() const
+   {
+      std::scoped_lock lock(m_snapshotLock);
+      return m_snapshot;
+   }
+
+   /// <summary>
+   /// Publishes a new snapshot with the passed item added
+   /// </summary>
+   /// <returns>The added item</returns>
+   const T& Add(T item)
+   {
+      auto snapshot = std::make_shared<Snapshot>();
+      snapshot->reserve(m_snapshot->size() + 1);
+      snapshot->assign(std::begin(*m_snapshot), std::end(*m_snapshot));
+      const T& added = snapshot->emplace_back(std::move(item));
+
+      publish(std::move(snapshot));
+
+      return added;
+   }
+
+   /// <summary>
+   /// Publishes a new snapshot without the passed item
+   /// </summary>
+   /// <returns>The removed item or a default constructed one if there is no such item</returns>
+   T Remove(const T& item)
+   {
+      auto itRemoved = std::find(std::begin(*m_snapshot), std::end(*m_snapshot), item);
+      if (itRemoved == std::end(*m_snapshot))
+      {
+         return T{};
+      }
+
+      T removed = *itRemoved;
+
+      auto snapshot = std::make_shared<Snapshot>();
+      snapshot->reserve(m_snapshot->size() - 1);
+      snapshot->insert(std::end(*snapshot), std::begin(*m_snapshot), itRemoved);
+      snapshot->insert(std::end(*snapshot), std::next(itRemoved), std::end(*m_snapshot));
+
+      publish(std::move(snapshot));
+
+      return removed;
+   }
+
+private:
+   /// <summary>
+   /// Replaces the current snapshot, the previous one is released out of the lock (it can be the last reference to the items)
+   /// </summary>
+   void publish(SnapshotPtr snapshot)
+   {
+      {
+         std::scoped_lock lock(m_snapshotLock);
+         m_snapshot.swap(snapshot);
+      }
+   }
+
+private:
+   mutable details::SpinLock m_snapshotLock; // guards m_snapshot against the readers, the owner reads it without the lock
+   SnapshotPtr m_snapshot = std::make_shared<const Snapshot>();
+};
+
+}
@@ -1,44 +1,79 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
 #include <list>
+#include <mutex>
 #include <tuple>
 #include <shared_mutex>
 
 #include <assert.h>
 
 #include "IValueSource.h"
+#include "CopyOnWriteVector.h"
+#include "Retention.h"
+#include "SegmentedStorage.h"
+#include "Stats.h"
+#include "Tracer.h"
 
 namespace MQP
 {
 
-template <typename Key, typename Value>
+/// <summary>
+/// DataManager's values storage policy: a node per value (std::list)
+/// </summary>
+struct StorageList
+{
+   template <typename T>
+   using Container = std::list<T>;
+};
+
+/// <summary>
+/// DataManager's values storage policy: fixed-size recycled segments of values (see SegmentedStorage)
+/// </summary>
+template <std::size_t SegmentSize = 64>
+struct StorageSegmented
+{
+   template <typename T>
+   using Container = SegmentedStorage<T, SegmentSize>;
+};
+
+template <typename Key, typename Value, typename StoragePolicy = StorageSegmented<>, typename TTracer = NoTracer>
 class DataManager;
 
-template <typename Key, typename Value>
-using DataManagerPtr = std::shared_ptr<DataManager<Key, Value>>;
+template <typename Key, typename Value, typename StoragePolicy = StorageSegmented<>, typename TTracer = NoTracer>
+using DataManagerPtr = std::shared_ptr<DataManager<Key, Value, StoragePolicy, TTracer>>;
 
 /// <summary>
 /// The class manages all incoming values and provides an ability to pull values individualy for each consumer (see DataManager::Locator).
 /// Makes a single copy of enqueued value in case it is an lvalue regardless of number of Locators for movable Value.
 /// Makes no copy of enqueued value in case it is a rvalue regardless of number of Locators for movable Value.
+/// The values storage is selected by StoragePolicy (StorageSegmented or StorageList).
+/// The count of values retained for the slowest Locator is bounded by RetentionSettings (see EOverflowPolicy).
+/// The latest values can be kept as a history regardless of the Locators (see RetentionSettings::historyCount),
+/// a new Locator can start from the history (see SubscriptionSettings) and reads it from the same storage.
+/// The history values yield to the capacity, they are erased first in case it is reached.
+/// TTracer (see Tracer.h) traces the values adding and the unused values collection.
 /// </summary>
-template <typename Key, typename Value>
-class DataManager : public std::enable_shared_from_this<DataManager<Key, Value>>
+template <typename Key, typename Value, typename StoragePolicy, typename TTracer>
+class DataManager : public std::enable_shared_from_this<DataManager<Key, Value, StoragePolicy, TTracer>>
 {
-   template <typename Value>
-   using ValuesStorage = std::list<std::tuple<Value, std::uint32_t>>;
+   using ValuesStorage = typename StoragePolicy::template Container<std::tuple<Value, std::uint32_t>>;
 
    /// <summary>
    /// The class implements IValueSource interface and controls sequantial reading for one consumer regardless others.
    /// </summary>
-   template <typename Key, typename Value>
-   class Locator : public IValueSource<Key, Value>, public std::enable_shared_from_this<Locator<Key, Value>>
+   class Locator : public IValueSource<Key, Value>, public std::enable_shared_from_this<Locator>
    {
-      friend DataManager<Key, Value>;
+      friend DataManager;
    public:
-      Locator(DataManagerPtr<Key, Value> dataManager, typename ValuesStorage<Value>::iterator position, IValueSourceConsumerPtr<Key, Value> consumer)
+      Locator(DataManagerPtr<Key, Value, StoragePolicy, TTracer> dataManager, typename ValuesStorage::iterator position, std::uint64_t sequence, IValueSourceConsumerPtr<Key, Value> consumer)
          : m_dataManager(std::move(dataManager))
          , m_position(position)
+         , m_sequence(sequence)
          , m_consumer(std::move(consumer))
       {
       }
@@ -56,12 +91,27 @@ class DataManager : public std::enable_shared_from_this<DataManager<Key, Value>>
 
       std::tuple<const Key&, const Value&> GetValue() const override
       {
-         return m_dataManager->getValue(m_position);
+         return m_dataManager->getValue(m_position, m_checkedOutCount);
+      }
+
+      std::tuple<const Key&, ValuesView<Value>> GetValues(std::size_t maxCount) const override
+      {
+         return m_dataManager->getValues(m_position, maxCount, m_checkedOutCount);
+      }
+
+      std::size_t GetLag() const override
+      {
+         return m_dataManager->getLag(m_sequence);
       }
 
       bool MoveNext() override
       {
-         return m_dataManager->moveNext(m_position);
+         return m_dataManager->moveNext(*this, 1);
+      }
+
+      bool MoveNext(std::size_t count) override
+      {
+         return m_dataManager->moveNext(*this, count);
       }
 
       bool HasValue() const override
@@ -82,10 +132,10 @@ class DataManager : public std::enable_shared_from_this<DataManager<Key, Value>>
 
    private:
 
-      using std::enable_shared_from_this<Locator<Key, Value>>::shared_from_this;
-      using std::enable_shared_from_this<Locator<Key, Value>>::weak_from_this;
+      using std::enable_shared_from_this<Locator>::shared_from_this;
+      using std::enable_shared_from_this<Locator>::weak_from_this;
 
-      typename ValuesStorage<Value>::iterator& getPosition()
+      typename ValuesStorage::iterator& getPosition()
       {
          return m_position;
       }
@@ -100,102 +150,458 @@ class DataManager : public std::enable_shared_from_this<DataManager<Key, Value>>
 
    private:
       std::atomic_bool m_isStopRequested = false;
-      DataManagerPtr<Key, Value> m_dataManager;
-      typename ValuesStorage<Value>::iterator m_position;
+      DataManagerPtr<Key, Value, StoragePolicy, TTracer> m_dataManager;
+      typename ValuesStorage::iterator m_position;
+      std::uint64_t m_sequence; // the stream index of m_position, it is guarded by the data manager's lock
+      // count of values got by GetValue(s) and not moved over yet, they must not be dropped (see EOverflowPolicy::dropOldest),
+      // it is written by the locator's reader under the data manager's shared lock and read under the exclusive one
+      mutable std::size_t m_checkedOutCount = 0;
+      // the values before are dropped while the preceding ones are checked out (see dropNextValue), the locator moves
+      // over them on its next moving, it is guarded by the data manager's lock
+      std::uint64_t m_dropUntil = 0;
       const IValueSourceConsumerWeakPtr<Key, Value> m_consumer;
    };
 
-   template <typename Key, typename Value>
-   using LocatorPtr = std::shared_ptr<Locator<Key, Value>>;
-
-   template <typename Key, typename Value>
-   using LocatorWeakPtr = std::weak_ptr<Locator<Key, Value>>;
+   using LocatorPtr = std::shared_ptr<Locator>;
 
 public:
 
-   DataManager(Key key) : m_key(std::move(key))
-   {}
+   DataManager(Key key, const RetentionSettings& retention = {}) : m_key(std::move(key)), m_retention(retention)
+   {
+      m_retention.capacity = std::max<std::size_t>(m_retention.capacity, 1);
+   }
 
    /// <summary>
-   /// Adds a new value
+   /// Adds a new value, the overflow policy is applied in case the capacity is reached (see RetentionSettings)
    /// </summary>
+   /// <returns>Whether the value is accepted, i.e. it is not rejected by EOverflowPolicy::fail</returns>
    template <typename TValue>
-   void AddValue(TValue&& value)
+   bool AddValue(TValue&& value)
    {
-      std::vector<LocatorPtr<Key, Value>> locatorsForUpdate;
+      details::TraceScope<TTracer> trace("DataManager::AddValue");
+
+      LocatorsSnapshotPtr locatorsForUpdate;
 
       {
-         std::scoped_lock lock(m_mutex);
+         std::unique_lock lock(m_mutex);
 
-         m_values.emplace_back(std::forward<TValue>(value), 0);
+         if (!makeRoom(lock))
+         {
+            return m_retention.overflowPolicy != EOverflowPolicy::fail;
+         }
 
-         const auto& itBack = std::prev(std::end(m_values));
+         const auto itAdded = m_values.emplace(std::end(m_values), std::forward<TValue>(value), 0);
+         locatorsForUpdate = onValuesAdded(itAdded, m_addedCount++);
+      }
+
+      notifyLocators(*locatorsForUpdate);
+      return true;
+   }
+
+   /// <summary>
+   /// Adds new values [first, last) under a single lock, each locator is notified once about all of them.
+   /// The values are moved in case of move iterators.
+   /// With a bounded capacity the values are added one by one, so the overflow policy is applied to each of them.
+   /// </summary>
+   /// <returns>Count of the values which are rejected by EOverflowPolicy::fail</returns>
+   template <typename InputIt>
+   std::size_t AddValues(InputIt first, InputIt last)
+   {
+      if (first == last)
+      {
+         return 0;
+      }
 
-         for (auto& locator : m_locators)
+      details::TraceScope<TTracer> trace("DataManager::AddValues");
+
+      if (m_retention.IsBounded())
+      {
+         std::size_t rejectedCount = 0;
+         for (; first != last; ++first)
          {
-            auto& position = locator->getPosition();
-            if (position == std::end(m_values))
-            {
-               // all locators have reached m_values's end, are set to the last value (the new one)
-               position = itBack;
-               ++(std::get<counter>(*position));
-            }
+            rejectedCount += AddValue(*first) ? 0 : 1;
          }
 
-         locatorsForUpdate = m_locators;
+         return rejectedCount;
       }
 
-      for (const auto& locator : locatorsForUpdate)
+      LocatorsSnapshotPtr locatorsForUpdate;
+
       {
-         locator->onNewValueAvailable();
+         std::scoped_lock lock(m_mutex);
+
+         const auto firstSequence = m_addedCount;
+         const auto itFirst = m_values.emplace(std::end(m_values), *first, 0);
+         ++m_addedCount;
+         for (++first; first != last; ++first)
+         {
+            m_values.emplace(std::end(m_values), *first, 0);
+            ++m_addedCount;
+         }
+
+         locatorsForUpdate = onValuesAdded(itFirst, firstSequence);
       }
+
+      notifyLocators(*locatorsForUpdate);
+      return 0;
    }
 
    /// <summary>
-   /// Creates a new value source for a consumer
+   /// Creates a new value source for a consumer, it starts from the end or from the history (see SubscriptionSettings).
+   /// The consumer is not notified about the history values, the caller checks IValueSource::HasValue.
    /// </summary>
-   IValueSourcePtr<Key, Value> CreateValueSource(IValueSourceConsumerPtr<Key, Value> consumer)
+   IValueSourcePtr<Key, Value> CreateValueSource(IValueSourceConsumerPtr<Key, Value> consumer, const SubscriptionSettings& subscription = {})
    {
       std::scoped_lock lock(m_mutex);
 
-      // Regardless m_values emptiness a new locator alway points to the end, cause all data in m_values is considiered as outdated for it
-      return m_locators.emplace_back(std::make_shared<Locator<Key, Value>>(shared_from_this(), m_values.end(), std::move(consumer)));
+      collectUnusedValues(); // the history could be expired
+
+      // Apart from the history all data in m_values is considiered as outdated for a new locator
+      auto startSequence = m_addedCount;
+      switch (subscription.startPosition)
+      {
+      case EStartPosition::oldestRetained:
+         startSequence = getReplayBegin();
+         break;
+      case EStartPosition::lastN:
+         startSequence = std::max(getReplayBegin(), m_addedCount - std::min<std::uint64_t>(subscription.replayCount, m_addedCount));
+         break;
+      case EStartPosition::now:
+      default:
+         break;
+      }
+
+      // the storage iterators are forward ones, so a replay walks from the oldest replayable value, not from the head
+      const auto position = startSequence == m_addedCount ? std::end(m_values) : getReplayPosition(startSequence);
+      if (position != std::end(m_values))
+      {
+         ++(std::get<counter>(*position));
+      }
+
+      return m_locators.Add(std::make_shared<Locator>(shared_from_this(), position, startSequence, std::move(consumer)));
    }
 
-   using std::enable_shared_from_this<DataManager<Key, Value>>::shared_from_this;
+   /// <summary>
+   /// Whether the key's values are kept as a history regardless of the locators, so the data manager is worth keeping without them
+   /// </summary>
+   bool IsHistoryRetained() const
+   {
+      return m_retention.HasHistory();
+   }
+
+   /// <summary>
+   /// Gets the values storage statistics
+   /// </summary>
+   DataManagerStats GetStats() const
+   {
+      std::shared_lock lock(m_mutex);
+
+      return { m_values.size(), getAllocatedBytes(m_values), m_overflowCounters.Get() };
+   }
+
+   using std::enable_shared_from_this<DataManager<Key, Value, StoragePolicy, TTracer>>::shared_from_this;
 
 private:
    enum { value, counter };
 
-   bool hasValue(typename const ValuesStorage<Value>::iterator& position) const
+   using LocatorsSnapshotPtr = typename CopyOnWriteVector<LocatorPtr>::SnapshotPtr;
+
+   /// <summary>
+   /// Sets all locators which have reached m_values's end to the first added value. Must be called under the lock.
+   /// </summary>
+   /// <returns>The locators to be notified about the added values</returns>
+   LocatorsSnapshotPtr onValuesAdded(typename ValuesStorage::iterator itFirstAdded, std::uint64_t firstSequence)
+   {
+      if (m_retention.historyDuration != std::chrono::nanoseconds::zero())
+      {
+         m_historyTimes.emplace_back(firstSequence, std::chrono::steady_clock::now());
+      }
+
+      if (m_replayPosition == std::end(m_values))
+      {
+         m_replayPosition = itFirstAdded;
+      }
+
+      auto locators = m_locators.Get();
+
+      for (auto& locator : *locators)
+      {
+         auto& position = locator->getPosition();
+         if (position == std::end(m_values))
+         {
+            position = itFirstAdded;
+            ++(std::get<counter>(*position));
+         }
+      }
+
+      if (std::get<counter>(*std::begin(m_values)) == 0)
+      {
+         // nobody is going to read the values or the head is a history value, keep the head used or within the history
+         collectUnusedValues();
+      }
+
+      if (m_retention.HasHistory())
+      {
+         // the replay position follows the history window, so the walk is amortized over the addings
+         advanceReplayPosition();
+      }
+
+      return locators;
+   }
+
+   /// <summary>
+   /// Applies the overflow policy in case the capacity is reached. Must be called under the lock.
+   /// </summary>
+   /// <returns>Whether a new value can be added</returns>
+   bool makeRoom(std::unique_lock<std::shared_mutex>& lock)
+   {
+      if (hasRoom())
+      {
+         return true;
+      }
+
+      switch (m_retention.overflowPolicy)
+      {
+      case EOverflowPolicy::block:
+      {
+         details::TraceScope<TTracer> trace("DataManager::waitForRoom");
+         details::OverflowCounters::Increment(m_overflowCounters.blockedCount);
+
+         ++m_waitersCount;
+         m_roomAvailable.wait(lock, [this]() { return hasRoom(); });
+         --m_waitersCount;
+         return true;
+      }
+      case EOverflowPolicy::dropOldest:
+         if (dropOldestValue())
+         {
+            details::OverflowCounters::Increment(m_overflowCounters.droppedOldestCount);
+            return true;
+         }
+
+         details::OverflowCounters::Increment(m_overflowCounters.droppedNewestCount);
+         return false;
+      case EOverflowPolicy::dropNewest:
+         details::OverflowCounters::Increment(m_overflowCounters.droppedNewestCount);
+         return false;
+      case EOverflowPolicy::fail:
+      default:
+         details::OverflowCounters::Increment(m_overflowCounters.rejectedCount);
+         return false;
+      }
+   }
+
+   /// <summary>
+   /// Whether a new value fits the capacity, the head value is erased for it in case it is an unused history value.
+   /// Must be called under the lock.
+   /// </summary>
+   bool hasRoom()
+   {
+      if (m_values.size() < m_retention.capacity)
+      {
+         return true;
+      }
+
+      collectUnusedValues(getHeadSequence() + 1);
+      return m_values.size() < m_retention.capacity;
+   }
+
+   /// <summary>
+   /// Moves the locators which point to the head value over it, so the head value is erased. Must be called under the lock.
+   /// In case the head value is being consumed, the oldest value which is not checked out is dropped instead (see dropNextValue).
+   /// Nothing is moved in case the head value is still used by an unsubscribed locator.
+   /// </summary>
+   /// <returns>Whether a value has been dropped</returns>
+   bool dropOldestValue()
+   {
+      const auto itHead = std::begin(m_values);
+      const auto locators = m_locators.Get();
+
+      std::uint32_t movableCount = 0;
+      for (const auto& locator : *locators)
+      {
+         if (locator->getPosition() == itHead)
+         {
+            if (locator->m_checkedOutCount != 0)
+            {
+               return dropNextValue(*locators);
+            }
+
+            ++movableCount;
+         }
+      }
+
+      if (movableCount != std::get<counter>(*itHead))
+      {
+         return false;
+      }
+
+      for (const auto& locator : *locators)
+      {
+         auto& position = locator->getPosition();
+         if (position == itHead)
+         {
+            ++position;
+            ++locator->m_sequence;
+            if (position != std::end(m_values))
+            {
+               ++(std::get<counter>(*position));
+            }
+         }
+      }
+
+      std::get<counter>(*itHead) = 0;
+      collectUnusedValues(getHeadSequence() + 1);
+      return true;
+   }
+
+   /// <summary>
+   /// Drops the oldest value which is going to be read and is not checked out, as the head value is being consumed.
+   /// The locators which have checked out the values before skip it on their next moving, the other ones which point to it
+   /// are moved over it. Nothing is erased till the head value is consumed, so the values are kept up to twice the capacity,
+   /// then the new value is dropped instead. Must be called under the lock.
+   /// </summary>
+   /// <returns>Whether a value has been dropped</returns>
+   bool dropNextValue(const std::vector<LocatorPtr>& locators)
+   {
+      if (m_values.size() >= 2 * m_retention.capacity)
+      {
+         return false;
+      }
+
+      const auto getNextUnread = [](const Locator& locator) { return std::max(locator.m_sequence + locator.m_checkedOutCount, locator.m_dropUntil); };
+
+      auto dropped = m_addedCount;
+      for (const auto& locator : locators)
+      {
+         dropped = std::min(dropped, getNextUnread(*locator));
+      }
+
+      if (dropped == m_addedCount)
+      {
+         // all values are checked out
+         return false;
+      }
+
+      for (const auto& locator : locators)
+      {
+         if (getNextUnread(*locator) != dropped)
+         {
+            continue;
+         }
+
+         if (locator->m_checkedOutCount != 0)
+         {
+            locator->m_dropUntil = dropped + 1;
+            continue;
+         }
+
+         auto& position = locator->getPosition();
+         const auto itPrevious = position;
+         ++position;
+         ++locator->m_sequence;
+         if (position != std::end(m_values))
+         {
+            ++(std::get<counter>(*position));
+         }
+
+         releaseValue(itPrevious);
+      }
+
+      return true;
+   }
+
+   static void notifyLocators(const std::vector<LocatorPtr>& locators)
+   {
+      for (const auto& locator : locators)
+      {
+         locator->onNewValueAvailable();
+      }
+   }
+
+   bool hasValue(const typename ValuesStorage::iterator& position) const
    {
       std::shared_lock lock(m_mutex);
 
       return position != std::end(m_values);
    }
 
-   std::tuple<const Key&, const Value&> getValue(typename const ValuesStorage<Value>::iterator& position) const
+   std::tuple<const Key&, const Value&> getValue(const typename ValuesStorage::iterator& position, std::size_t& checkedOutCount) const
    {
       std::shared_lock lock(m_mutex);
 
       assert(position != std::end(m_values));
+      checkedOutCount = 1;
       return { m_key, std::get<value>(*position) };
    }
 
-   bool moveNext(typename ValuesStorage<Value>::iterator& position)
+   /// <summary>
+   /// Gets the values starting from the position which are neighbouring records in the storage (e.g. in a segment),
+   /// so they form a strided run of values
+   /// </summary>
+   std::tuple<const Key&, ValuesView<Value>> getValues(const typename ValuesStorage::iterator& position, std::size_t maxCount, std::size_t& checkedOutCount) const
+   {
+      std::shared_lock lock(m_mutex);
+
+      assert(position != std::end(m_values) && maxCount != 0);
+
+      constexpr auto stride = sizeof(typename ValuesStorage::value_type);
+
+      const Value* first = &std::get<value>(*position);
+      const auto* firstBytes = reinterpret_cast<const std::byte*>(first);
+
+      std::size_t count = 1;
+      for (auto it = std::next(position); count != maxCount && it != std::end(m_values); ++it, ++count)
+      {
+         if (reinterpret_cast<const std::byte*>(&std::get<value>(*it)) != firstBytes + count * stride)
+         {
+            break;
+         }
+      }
+
+      checkedOutCount = count;
+      return { m_key, ValuesView<Value>(first, count, stride) };
+   }
+
+   std::size_t getLag(const std::uint64_t& sequence) const
+   {
+      std::shared_lock lock(m_mutex);
+
+      return static_cast<std::size_t>(m_addedCount - sequence);
+   }
+
+   bool moveNext(Locator& locator, std::size_t count)
    {
       std::scoped_lock lock(m_mutex);
 
-      assert(position != std::end(m_values));
+      auto& position = locator.getPosition();
+      auto& sequence = locator.m_sequence;
+      const auto itPrevious = position;
+      const bool isCheckedOutPassed = count >= locator.m_checkedOutCount;
+      for (; count != 0; --count, ++sequence)
+      {
+         assert(position != std::end(m_values));
+         ++position;
+      }
 
-      --(std::get<counter>(*position));
-      const bool reachTheEnd = (++position == std::end(m_values));
+      // the values which have been dropped after the checked out ones are skipped, they are kept in case of a partial moving
+      for (; isCheckedOutPassed && sequence < locator.m_dropUntil; ++sequence)
+      {
+         assert(position != std::end(m_values));
+         ++position;
+      }
+
+      locator.m_checkedOutCount = 0;
+      locator.m_dropUntil = 0;
+
+      // only the values which locators point to are counted, the passed over ones are not used by this locator
+      const bool reachTheEnd = (position == std::end(m_values));
       if (!reachTheEnd)
       {
          ++(std::get<counter>(*position));
       }
 
-      collectUnusedValues();
+      releaseValue(itPrevious);
 
       return !reachTheEnd;
    }
@@ -204,33 +610,22 @@ private:
    /// Unsubscribe the passed locator from updates
    /// The method still keeps available Locator::GetValue method correct work
    /// </summary>
-   void unsubscribeLocator(LocatorPtr<Key, Value> locator)
+   void unsubscribeLocator(LocatorPtr locator)
    {
-      LocatorPtr<Key, Value> unsubscribedLocator;
+      LocatorPtr unsubscribedLocator;
 
       {
          std::scoped_lock lock(m_mutex);
 
-         auto itUnsubscribedLocator = std::find_if(std::begin(m_locators), std::end(m_locators), [&locator](const auto& loc)
-            {
-               return loc == locator;
-            });
-
-         if (itUnsubscribedLocator == std::end(m_locators))
-         {
-            assert(false);
-            return;
-         }
-
-         unsubscribedLocator = std::move(*itUnsubscribedLocator);
-         m_locators.erase(itUnsubscribedLocator);
+         unsubscribedLocator = m_locators.Remove(locator);
+         assert(unsubscribedLocator);
       }
    }
 
    /// <summary>
    /// The method must be called in Locator dtor ONLY, as Locator::GetValue method cannot be used after this call
    /// </summary>
-   void unregisterLocator(Locator<Key, Value>* locator)
+   void unregisterLocator(Locator* locator)
    {
       std::scoped_lock lock(m_mutex);
 
@@ -246,26 +641,156 @@ private:
          return;
       }
 
-      --(std::get<counter>(*locatorPosition));
+      releaseValue(locatorPosition);
+   }
 
-      collectUnusedValues();
+   /// <summary>
+   /// Releases a value that has been used by a locator.
+   /// Values are erased strictly from the head and the head value is always used by the slowest locator or kept as history,
+   /// so only the head value can become erasable. Releasing of any other value costs O(1) and each erased value
+   /// is visited once, so the reclamation is amortized O(1) regardless of the backlog depth.
+   /// </summary>
+   void releaseValue(typename ValuesStorage::iterator position)
+   {
+      if (--(std::get<counter>(*position)) == 0 && position == std::begin(m_values))
+      {
+         collectUnusedValues();
+      }
    }
 
+   /// <summary>
+   /// Erases all values from the head up to the first used one, the history values are kept
+   /// </summary>
    void collectUnusedValues()
    {
-      auto itFirstUsed = std::find_if(std::begin(m_values), std::end(m_values), [](const auto& value) 
+      collectUnusedValues(getHistoryBegin());
+   }
+
+   /// <summary>
+   /// Erases the values from the head up to the first used one or the one with the passed sequence
+   /// </summary>
+   void collectUnusedValues(std::uint64_t keptFrom)
+   {
+      details::TraceScope<TTracer> trace("DataManager::collectUnusedValues");
+
+      auto itFirstKept = std::begin(m_values);
+      for (auto sequence = getHeadSequence(); itFirstKept != std::end(m_values) && std::get<counter>(*itFirstKept) == 0 && sequence < keptFrom; ++sequence)
+      {
+         ++itFirstKept;
+      }
+
+      m_values.erase(std::begin(m_values), itFirstKept);
+
+      if (m_replaySequence < getHeadSequence())
+      {
+         // the replay position has been erased
+         m_replayPosition = std::begin(m_values);
+         m_replaySequence = getHeadSequence();
+      }
+
+      if (m_waitersCount != 0)
+      {
+         m_roomAvailable.notify_all();
+      }
+   }
+
+   /// <summary>
+   /// Gets the stream index of the head value. Must be called under the lock.
+   /// </summary>
+   std::uint64_t getHeadSequence() const
+   {
+      return m_addedCount - m_values.size();
+   }
+
+   /// <summary>
+   /// Gets the stream index of the oldest history value, the expired history times are dropped. Must be called under the lock.
+   /// </summary>
+   std::uint64_t getHistoryBegin()
+   {
+      if (!m_retention.HasHistory())
+      {
+         return m_addedCount;
+      }
+
+      std::uint64_t historyBegin = 0;
+      if (m_retention.historyCount != 0)
+      {
+         historyBegin = m_addedCount - std::min<std::uint64_t>(m_retention.historyCount, m_addedCount);
+      }
+
+      if (m_retention.historyDuration != std::chrono::nanoseconds::zero())
+      {
+         const auto expiry = std::chrono::steady_clock::now() - m_retention.historyDuration;
+         while (!m_historyTimes.empty() && std::get<1>(m_historyTimes.front()) < expiry)
          {
-            return std::get<counter>(value) != 0; 
-         });
+            m_historyTimes.pop_front();
+         }
+
+         historyBegin = std::max(historyBegin, m_historyTimes.empty() ? m_addedCount : std::get<0>(m_historyTimes.front()));
+      }
+
+      return historyBegin;
+   }
+
+   /// <summary>
+   /// Gets the stream index of the oldest value a new locator can start from. Must be called under the lock.
+   /// </summary>
+   std::uint64_t getReplayBegin()
+   {
+      return std::max(getHeadSequence(), getHistoryBegin());
+   }
 
-      m_values.erase(std::begin(m_values), itFirstUsed);
+   /// <summary>
+   /// Moves the kept replay position forward to the oldest replayable value. Must be called under the lock.
+   /// </summary>
+   void advanceReplayPosition()
+   {
+      for (const auto replayBegin = getReplayBegin(); m_replaySequence < replayBegin; ++m_replaySequence)
+      {
+         ++m_replayPosition;
+      }
+   }
+
+   /// <summary>
+   /// Gets the position of a value to be replayed. The kept replay position follows the oldest replayable value
+   /// on each adding (see onValuesAdded), so a replay costs the history depth at most regardless of the values kept
+   /// for the locators. Must be called under the lock.
+   /// </summary>
+   typename ValuesStorage::iterator getReplayPosition(std::uint64_t sequence)
+   {
+      advanceReplayPosition(); // the history could be expired since the last adding
+
+      assert(m_replaySequence <= sequence && sequence <= m_addedCount);
+      return std::next(m_replayPosition, static_cast<std::ptrdiff_t>(sequence - m_replaySequence));
+   }
+
+   template <typename T, std::size_t SegmentSize>
+   static std::size_t getAllocatedBytes(const SegmentedStorage<T, SegmentSize>& values)
+   {
+      return values.allocated_bytes();
+   }
+
+   template <typename T>
+   static std::size_t getAllocatedBytes(const std::list<T>& values)
+   {
+      return values.size() * (sizeof(T) + 2 * sizeof(void*)); // a node keeps two links
    }
 
 private:
-   mutable std::shared_mutex m_mutex; // guards m_values and m_locators
+   mutable std::shared_mutex m_mutex; // guards m_values, m_locators, m_waitersCount, m_historyTimes and the replay position
    const Key m_key;
-   ValuesStorage<Value> m_values;
-   std::vector<LocatorPtr<Key, Value>> m_locators;
+   RetentionSettings m_retention;
+   details::OverflowCounters m_overflowCounters;
+   std::condition_variable_any m_roomAvailable; // producers wait for room with EOverflowPolicy::block
+   std::size_t m_waitersCount = 0; // count of producers which wait for room
+   ValuesStorage m_values;
+   std::uint64_t m_addedCount = 0; // the stream index of the next added value
+   // the stream index of the first value of each adding and its time, they are kept for RetentionSettings::historyDuration only
+   std::deque<std::tuple<std::uint64_t, std::chrono::steady_clock::time_point>> m_historyTimes;
+   // a value not older than the head and its stream index, a replay walks from it (see getReplayPosition)
+   typename ValuesStorage::iterator m_replayPosition = std::end(m_values);
+   std::uint64_t m_replaySequence = 0;
+   CopyOnWriteVector<LocatorPtr> m_locators;
 };
 
 }
\ No newline at end of file
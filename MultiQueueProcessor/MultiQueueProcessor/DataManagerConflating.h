@@ -0,0 +1,296 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tuple>
+
+#include <assert.h>
+
+#include "IValueSource.h"
+#include "CopyOnWriteVector.h"
+#include "Retention.h"
+#include "Stats.h"
+#include "Tracer.h"
+
+namespace MQP
+{
+
+template <typename Key, typename Value, typename TTracer = NoTracer>
+class DataManagerConflating;
+
+template <typename Key, typename Value, typename TTracer = NoTracer>
+using DataManagerConflatingPtr = std::shared_ptr<DataManagerConflating<Key, Value, TTracer>>;
+
+/// <summary>
+/// The class manages the last value of a key and creates instances of IValueSource implementation (see DataManagerConflating::Locator).
+/// Each Locator keeps at most one pending value: a new value overwrites the pending one in place (move-assignment),
+/// and the consumer is notified only in case no value is pending, so a consumer gets the latest value and its work
+/// as well as the memory stay bounded regardless of the producers' bursts.
+/// A Locator keeps one more value besides the pending one, the value which is being consumed.
+/// The retention settings are not applicable, a Locator never keeps more than the latest value.
+/// TTracer (see Tracer.h) traces the values adding.
+/// </summary>
+template <typename Key, typename Value, typename TTracer>
+class DataManagerConflating : public std::enable_shared_from_this<DataManagerConflating<Key, Value, TTracer>>
+{
+   /// <summary>
+   /// The class implements IValueSource interface and controls sequantial reading for one consumer regardless others.
+   /// </summary>
+   class Locator : public IValueSource<Key, Value>, public std::enable_shared_from_this<Locator>
+   {
+      friend DataManagerConflating;
+   public:
+      Locator(DataManagerConflatingPtr<Key, Value, TTracer> dataManager, IValueSourceConsumerPtr<Key, Value> consumer, const Key& key)
+         : m_dataManager(std::move(dataManager))
+         , m_consumer(std::move(consumer))
+         , m_key(key)
+      {
+      }
+
+      Locator(const Locator&) = delete;
+      Locator& operator=(const Locator&) = delete;
+      Locator(Locator&&) = delete;
+      Locator& operator=(Locator&&) = delete;
+
+      std::tuple<const Key&, const Value&> GetValue() const override
+      {
+         std::scoped_lock lock(m_mutex);
+
+         return { m_key, checkOut() };
+      }
+
+      std::tuple<const Key&, ValuesView<Value>> GetValues([[maybe_unused]] std::size_t maxCount) const override
+      {
+         std::scoped_lock lock(m_mutex);
+
+         assert(maxCount != 0);
+         return { m_key, ValuesView<Value>(&checkOut(), 1) };
+      }
+
+      bool MoveNext() override
+      {
+         return MoveNext(1);
+      }
+
+      bool MoveNext([[maybe_unused]] std::size_t count) override
+      {
+         std::scoped_lock lock(m_mutex);
+
+         assert(count == 1 && m_current);
+         m_current.reset();
+         return m_pending.has_value();
+      }
+
+      bool HasValue() const override
+      {
+         std::scoped_lock lock(m_mutex);
+
+         return m_current || m_pending;
+      }
+
+      std::size_t GetLag() const override
+      {
+         std::scoped_lock lock(m_mutex);
+
+         return (m_current ? 1 : 0) + (m_pending ? 1 : 0);
+      }
+
+      void Stop() override
+      {
+         m_isStopRequested = true;
+         m_dataManager->unsubscribeLocator(shared_from_this());
+      }
+
+      bool IsStopped() const override
+      {
+         return m_isStopRequested;
+      }
+
+   private:
+
+      using std::enable_shared_from_this<Locator>::shared_from_this;
+
+      /// <summary>
+      /// Takes the pending value for consuming, unless a value is taken already. Must be called under the lock.
+      /// The taken value is not overwritten by new values till the locator is moved over it.
+      /// </summary>
+      const Value& checkOut() const
+      {
+         if (!m_current)
+         {
+            assert(m_pending);
+            m_current = std::move(m_pending);
+            m_pending.reset();
+         }
+
+         return *m_current;
+      }
+
+      /// <summary>
+      /// Sets the pending value, the consumer is notified in case no value has been pending
+      /// </summary>
+      template <typename TValue>
+      void onNewValueAvailable(TValue&& value)
+      {
+         bool isNotificationRequired = false;
+
+         {
+            std::scoped_lock lock(m_mutex);
+
+            if (m_pending)
+            {
+               *m_pending = std::forward<TValue>(value);
+               m_dataManager->m_conflatedCount.fetch_add(1, std::memory_order_relaxed);
+            }
+            else
+            {
+               m_pending.emplace(std::forward<TValue>(value));
+               isNotificationRequired = true;
+            }
+         }
+
+         if (isNotificationRequired)
+         {
+            notifyConsumer();
+         }
+      }
+
+      void notifyConsumer()
+      {
+         if (auto spConsumer = m_consumer.lock())
+         {
+            spConsumer->OnNewValueAvailable(shared_from_this());
+         }
+      }
+
+   private:
+      std::atomic_bool m_isStopRequested = false;
+      DataManagerConflatingPtr<Key, Value, TTracer> m_dataManager;
+      const IValueSourceConsumerWeakPtr<Key, Value> m_consumer;
+      mutable std::mutex m_mutex; // guards m_current and m_pending
+      mutable std::optional<Value> m_current; // the value which is being consumed
+      mutable std::optional<Value> m_pending; // the latest value which is not taken for consuming yet
+      const Key m_key;
+   };
+
+   using LocatorPtr = std::shared_ptr<Locator>;
+
+public:
+
+   DataManagerConflating(Key key, const RetentionSettings& /*retention*/ = {}) : m_key(std::move(key))
+   {}
+
+   /// <summary>
+   /// Adds a new value, it overwrites each locator's pending value
+   /// </summary>
+   /// <returns>Always true, a value is never rejected</returns>
+   template <typename TValue>
+   bool AddValue(TValue&& value)
+   {
+      details::TraceScope<TTracer> trace("DataManagerConflating::AddValue");
+
+      const auto locatorsForUpdate = m_locators.Get();
+
+      for (auto itLocator = std::begin(*locatorsForUpdate); itLocator != std::end(*locatorsForUpdate); ++itLocator)
+      {
+         if (std::next(itLocator) == std::end(*locatorsForUpdate))
+         {
+            (*itLocator)->onNewValueAvailable(std::forward<TValue>(value));
+         }
+         else
+         {
+            (*itLocator)->onNewValueAvailable(static_cast<const Value&>(value));
+         }
+      }
+
+      return true;
+   }
+
+   /// <summary>
+   /// Adds new values [first, last), only the last one is passed to the locators, the others are conflated right away.
+   /// The last locator takes the value by moving in case of move iterators.
+   /// </summary>
+   /// <returns>Always zero, a value is never rejected</returns>
+   template <typename ForwardIt>
+   std::size_t AddValues(ForwardIt first, ForwardIt last)
+   {
+      if (first == last)
+      {
+         return 0;
+      }
+
+      details::TraceScope<TTracer> trace("DataManagerConflating::AddValues");
+
+      std::uint64_t conflatedCount = 0;
+
+      auto itLast = first;
+      for (auto it = std::next(first); it != last; ++it, ++conflatedCount)
+      {
+         itLast = it;
+      }
+
+      m_conflatedCount.fetch_add(conflatedCount * m_locators.Get()->size(), std::memory_order_relaxed);
+
+      AddValue(*itLast);
+      return 0;
+   }
+
+   /// <summary>
+   /// Creates a new value source for a consumer
+   /// </summary>
+   IValueSourcePtr<Key, Value> CreateValueSource(IValueSourceConsumerPtr<Key, Value> consumer)
+   {
+      std::scoped_lock lock(m_mutex);
+
+      return m_locators.Add(std::make_shared<Locator>(shared_from_this(), std::move(consumer), m_key));
+   }
+
+   /// <summary>
+   /// Gets the values storage statistics, the values are kept by the locators
+   /// </summary>
+   DataManagerStats GetStats() const
+   {
+      DataManagerStats stats;
+
+      for (const auto& locator : *m_locators.Get())
+      {
+         stats.retainedValuesCount += locator->GetLag();
+      }
+
+      stats.retainedBytes = stats.retainedValuesCount * sizeof(Value);
+      stats.conflatedCount = m_conflatedCount.load(std::memory_order_relaxed);
+      return stats;
+   }
+
+   using std::enable_shared_from_this<DataManagerConflating<Key, Value, TTracer>>::shared_from_this;
+
+private:
+
+   /// <summary>
+   /// Unsubscribe the passed locator from updates
+   /// The method still keeps available Locator::GetValue method correct work
+   /// </summary>
+   void unsubscribeLocator(LocatorPtr locator)
+   {
+      LocatorPtr unsubscribedLocator;
+
+      {
+         std::scoped_lock lock(m_mutex);
+
+         unsubscribedLocator = m_locators.Remove(locator); // destroying out of the lock
+         assert(unsubscribedLocator);
+      }
+   }
+
+private:
+   mutable std::mutex m_mutex; // serializes m_locators modifications
+   const Key m_key;
+   CopyOnWriteVector<LocatorPtr> m_locators;
+   std::atomic_uint64_t m_conflatedCount = 0; // count of values overwritten before consuming, per locator
+};
+
+}
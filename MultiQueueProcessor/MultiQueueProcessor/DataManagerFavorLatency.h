@@ -0,0 +1,434 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <assert.h>
+
+#include "IValueSource.h"
+#include "CopyOnWriteVector.h"
+#include "Retention.h"
+#include "Stats.h"
+#include "Tracer.h"
+
+namespace MQP
+{
+
+/// <summary>
+/// The default count of DataManagerFavorLatency's ring slots
+/// </summary>
+constexpr std::size_t defaultRingCapacity = 1024;
+
+template <typename Key, typename Value, std::size_t Capacity = defaultRingCapacity, typename TTracer = NoTracer>
+class DataManagerFavorLatency;
+
+template <typename Key, typename Value, std::size_t Capacity = defaultRingCapacity, typename TTracer = NoTracer>
+using DataManagerFavorLatencyPtr = std::shared_ptr<DataManagerFavorLatency<Key, Value, Capacity, TTracer>>;
+
+/// <summary>
+/// The class manages all incoming values in a preallocated broadcast ring (Disruptor-like) and creates instances of
+/// IValueSource implementation (see DataManagerFavorLatency::Locator).
+/// A producer claims a sequence, writes the value into the ring's slot and publishes the sequence in the claim order.
+/// Each Locator keeps its own read sequence, so reading (GetValue, HasValue, MoveNext) takes no locks.
+/// A producer waits while the slot it has claimed is still used by the slowest Locator, so the ring never grows.
+/// Value must be default constructible and assignable, a value is kept in the ring until its slot is reused.
+/// Makes a single copy of enqueued value in case it is an lvalue regardless of number of Locators.
+/// RetentionSettings can bound the producers' lead over the slowest Locator below the ring capacity and select
+/// another overflow policy than the waiting (see EOverflowPolicy).
+/// TTracer (see Tracer.h) traces the values adding and the producers' waiting for a free slot.
+/// </summary>
+template <typename Key, typename Value, std::size_t Capacity, typename TTracer>
+class DataManagerFavorLatency : public std::enable_shared_from_this<DataManagerFavorLatency<Key, Value, Capacity, TTracer>>
+{
+   static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "The ring capacity must be a power of two");
+
+   static constexpr std::uint64_t mask = Capacity - 1;
+
+   /// <summary>
+   /// The class implements IValueSource interface and controls sequantial reading for one consumer regardless others.
+   /// </summary>
+   class Locator : public IValueSource<Key, Value>, public std::enable_shared_from_this<Locator>
+   {
+      friend DataManagerFavorLatency;
+   public:
+      Locator(DataManagerFavorLatencyPtr<Key, Value, Capacity, TTracer> dataManager, std::uint64_t sequence, IValueSourceConsumerPtr<Key, Value> consumer)
+         : m_sequence(sequence)
+         , m_dataManager(std::move(dataManager))
+         , m_consumer(std::move(consumer))
+      {
+      }
+
+      Locator(const Locator&) = delete;
+      Locator& operator=(const Locator&) = delete;
+      Locator(Locator&&) = delete;
+      Locator& operator=(Locator&&) = delete;
+
+      std::tuple<const Key&, const Value&> GetValue() const override
+      {
+         return m_dataManager->getValue(m_sequence.load(std::memory_order_relaxed));
+      }
+
+      std::tuple<const Key&, ValuesView<Value>> GetValues(std::size_t maxCount) const override
+      {
+         return m_dataManager->getValues(m_sequence.load(std::memory_order_relaxed), maxCount);
+      }
+
+      bool MoveNext() override
+      {
+         return MoveNext(1);
+      }
+
+      bool MoveNext(std::size_t count) override
+      {
+         // the release store hands the slots back to producers
+         const auto sequence = m_sequence.load(std::memory_order_relaxed) + count;
+         m_sequence.store(sequence, std::memory_order_release);
+         return m_dataManager->hasValue(sequence);
+      }
+
+      bool HasValue() const override
+      {
+         return m_dataManager->hasValue(m_sequence.load(std::memory_order_relaxed));
+      }
+
+      std::size_t GetLag() const override
+      {
+         return m_dataManager->getLag(getSequence());
+      }
+
+      void Stop() override
+      {
+         m_isStopRequested = true;
+         m_dataManager->unsubscribeLocator(shared_from_this());
+      }
+
+      bool IsStopped() const override
+      {
+         return m_isStopRequested;
+      }
+
+   private:
+
+      using std::enable_shared_from_this<Locator>::shared_from_this;
+
+      std::uint64_t getSequence() const
+      {
+         return m_sequence.load(std::memory_order_acquire);
+      }
+
+      void onNewValueAvailable()
+      {
+         if (auto spConsumer = m_consumer.lock())
+         {
+            spConsumer->OnNewValueAvailable(shared_from_this());
+         }
+      }
+
+   private:
+      alignas(64) std::atomic_uint64_t m_sequence; // the next sequence to read, it is written by the reader only
+      std::atomic_bool m_isStopRequested = false;
+      DataManagerFavorLatencyPtr<Key, Value, Capacity, TTracer> m_dataManager;
+      const IValueSourceConsumerWeakPtr<Key, Value> m_consumer;
+   };
+
+   using LocatorPtr = std::shared_ptr<Locator>;
+
+public:
+
+   DataManagerFavorLatency(Key key, const RetentionSettings& retention = {})
+      : m_key(std::move(key))
+      , m_ring(std::make_unique<Value[]>(Capacity))
+      , m_capacity(std::clamp<std::uint64_t>(retention.capacity, 1, Capacity))
+      , m_overflowPolicy(retention.overflowPolicy)
+   {}
+
+   /// <summary>
+   /// Adds a new value, the overflow policy is applied in case the slowest locator lags by the capacity.
+   /// EOverflowPolicy::dropOldest is applied as dropNewest, as the locators read the ring without locks.
+   /// </summary>
+   /// <returns>Whether the value is accepted, i.e. it is not rejected by EOverflowPolicy::fail</returns>
+   template <typename TValue>
+   bool AddValue(TValue&& value)
+   {
+      details::TraceScope<TTracer> trace("DataManagerFavorLatency::AddValue");
+
+      std::uint64_t sequence = 0;
+      if (m_overflowPolicy == EOverflowPolicy::block)
+      {
+         sequence = m_claimed.fetch_add(1, std::memory_order_relaxed);
+         waitForSlot(sequence);
+      }
+      else if (!tryClaim(sequence))
+      {
+         return onNoSlot();
+      }
+
+      m_ring[sequence & mask] = std::forward<TValue>(value);
+
+      publish(sequence, 1);
+      return true;
+   }
+
+   /// <summary>
+   /// Adds new values [first, last), the values are published and each locator is notified once per capacity.
+   /// The values are moved in case of move iterators.
+   /// The values are added one by one with an overflow policy other than the waiting.
+   /// </summary>
+   /// <returns>Count of the values which are rejected by EOverflowPolicy::fail</returns>
+   template <typename ForwardIt>
+   std::size_t AddValues(ForwardIt first, ForwardIt last)
+   {
+      details::TraceScope<TTracer> trace("DataManagerFavorLatency::AddValues");
+
+      if (m_overflowPolicy != EOverflowPolicy::block)
+      {
+         std::size_t rejectedCount = 0;
+         for (; first != last; ++first)
+         {
+            rejectedCount += AddValue(*first) ? 0 : 1;
+         }
+
+         return rejectedCount;
+      }
+
+      auto count = static_cast<std::uint64_t>(std::distance(first, last));
+
+      while (count != 0)
+      {
+         const auto claimed = std::min<std::uint64_t>(count, m_capacity);
+         const auto sequence = m_claimed.fetch_add(claimed, std::memory_order_relaxed);
+
+         waitForSlot(sequence + claimed - 1);
+
+         for (auto slot = sequence; slot != sequence + claimed; ++slot, ++first)
+         {
+            m_ring[slot & mask] = *first;
+         }
+
+         publish(sequence, claimed);
+
+         count -= claimed;
+      }
+
+      return 0;
+   }
+
+   /// <summary>
+   /// Creates a new value source for a consumer
+   /// </summary>
+   IValueSourcePtr<Key, Value> CreateValueSource(IValueSourceConsumerPtr<Key, Value> consumer)
+   {
+      std::scoped_lock lock(m_mutex);
+
+      // a new locator starts from the next published value, all values in the ring are considered as outdated for it
+      return m_locators.Add(std::make_shared<Locator>(shared_from_this(), m_published.load(std::memory_order_acquire), std::move(consumer)));
+   }
+
+   /// <summary>
+   /// Gets the values storage statistics, the ring is preallocated, so it is retained as a whole
+   /// </summary>
+   DataManagerStats GetStats() const
+   {
+      std::size_t maxLag = 0;
+      for (const auto& locator : *m_locators.Get())
+      {
+         maxLag = std::max(maxLag, locator->GetLag());
+      }
+
+      return { maxLag, Capacity * sizeof(Value), m_overflowCounters.Get() };
+   }
+
+   using std::enable_shared_from_this<DataManagerFavorLatency<Key, Value, Capacity, TTracer>>::shared_from_this;
+
+private:
+
+   bool hasValue(std::uint64_t sequence) const
+   {
+      return sequence < m_published.load(std::memory_order_acquire);
+   }
+
+   std::size_t getLag(std::uint64_t sequence) const
+   {
+      const auto published = m_published.load(std::memory_order_acquire);
+      return published > sequence ? static_cast<std::size_t>(published - sequence) : 0;
+   }
+
+   std::tuple<const Key&, const Value&> getValue(std::uint64_t sequence) const
+   {
+      assert(hasValue(sequence));
+      return { m_key, m_ring[sequence & mask] };
+   }
+
+   /// <summary>
+   /// Gets the published values starting from the sequence up to the ring's wrap
+   /// </summary>
+   std::tuple<const Key&, ValuesView<Value>> getValues(std::uint64_t sequence, std::size_t maxCount) const
+   {
+      assert(hasValue(sequence) && maxCount != 0);
+
+      const auto available = m_published.load(std::memory_order_acquire) - sequence;
+      const auto tillWrap = Capacity - (sequence & mask);
+      const auto count = std::min<std::uint64_t>({ available, tillWrap, maxCount });
+
+      return { m_key, ValuesView<Value>(&m_ring[sequence & mask], static_cast<std::size_t>(count)) };
+   }
+
+   /// <summary>
+   /// Publishes the written sequences [sequence, sequence + count) and notifies the locators
+   /// </summary>
+   void publish(std::uint64_t sequence, std::uint64_t count)
+   {
+      // sequences are published strictly in the claim order
+      while (m_published.load(std::memory_order_acquire) != sequence)
+      {
+         std::this_thread::yield();
+      }
+
+      m_published.store(sequence + count, std::memory_order_release);
+
+      // the locators are taken after the publishing, so a locator that is created before has to be notified
+      const auto locatorsForUpdate = m_locators.Get();
+
+      for (const auto& locator : *locatorsForUpdate)
+      {
+         locator->onNewValueAvailable();
+      }
+   }
+
+   /// <summary>
+   /// Waits till the slot of the passed sequence is not used by any locator.
+   /// </summary>
+   void waitForSlot(std::uint64_t sequence)
+   {
+      if (sequence < m_gatingCache.load(std::memory_order_acquire) + m_capacity)
+      {
+         return;
+      }
+
+      details::TraceScope<TTracer> trace("DataManagerFavorLatency::waitForSlot");
+
+      for (bool isBlocked = false; sequence >= updateGating() + m_capacity; isBlocked = true)
+      {
+         if (!isBlocked)
+         {
+            details::OverflowCounters::Increment(m_overflowCounters.blockedCount);
+         }
+
+         std::this_thread::yield();
+      }
+   }
+
+   /// <summary>
+   /// Claims the next sequence in case its slot is not used by any locator
+   /// </summary>
+   bool tryClaim(std::uint64_t& sequence)
+   {
+      sequence = m_claimed.load(std::memory_order_relaxed);
+
+      while (true)
+      {
+         if (sequence >= m_gatingCache.load(std::memory_order_acquire) + m_capacity && sequence >= updateGating() + m_capacity)
+         {
+            return false;
+         }
+
+         if (m_claimed.compare_exchange_weak(sequence, sequence + 1, std::memory_order_relaxed))
+         {
+            return true;
+         }
+      }
+   }
+
+   /// <summary>
+   /// Counts a value which has got no slot
+   /// </summary>
+   /// <returns>Whether the value is accepted, i.e. it is dropped rather than rejected</returns>
+   bool onNoSlot()
+   {
+      if (m_overflowPolicy == EOverflowPolicy::fail)
+      {
+         details::OverflowCounters::Increment(m_overflowCounters.rejectedCount);
+         return false;
+      }
+
+      details::OverflowCounters::Increment(m_overflowCounters.droppedNewestCount);
+      return true;
+   }
+
+   /// <summary>
+   /// Finds the slowest read sequence and caches it.
+   /// The published cursor takes part in the gating too, so a locator that is created later
+   /// (it starts from the published cursor) cannot be overtaken.
+   /// </summary>
+   std::uint64_t updateGating()
+   {
+      std::uint64_t gating = 0;
+
+      {
+         std::scoped_lock lock(m_mutex);
+
+         gating = m_published.load(std::memory_order_acquire);
+         for (const auto& locator : *m_locators.Get())
+         {
+            gating = std::min(gating, locator->getSequence());
+         }
+
+         // an unsubscribed locator can still be read by a running consumer task till its destruction
+         m_retiredLocators.erase(std::remove_if(std::begin(m_retiredLocators), std::end(m_retiredLocators), [&gating](const auto& retired)
+            {
+               auto locator = retired.lock();
+               if (locator)
+               {
+                  gating = std::min(gating, locator->getSequence());
+               }
+
+               return !locator;
+            }), std::end(m_retiredLocators));
+      }
+
+      m_gatingCache.store(gating, std::memory_order_release);
+      return gating;
+   }
+
+   /// <summary>
+   /// Unsubscribe the passed locator from updates
+   /// The method still keeps available Locator::GetValue method correct work
+   /// </summary>
+   void unsubscribeLocator(LocatorPtr locator)
+   {
+      LocatorPtr unsubscribedLocator;
+
+      {
+         std::scoped_lock lock(m_mutex);
+
+         unsubscribedLocator = m_locators.Remove(locator); // destroying out of the lock
+         if (!unsubscribedLocator)
+         {
+            assert(false);
+            return;
+         }
+
+         m_retiredLocators.emplace_back(unsubscribedLocator);
+      }
+   }
+
+private:
+   alignas(64) std::atomic_uint64_t m_claimed = 0; // the next sequence to claim by a producer
+   alignas(64) std::atomic_uint64_t m_published = 0; // all sequences below are readable
+   alignas(64) std::atomic_uint64_t m_gatingCache = 0; // the last known slowest read sequence
+   const Key m_key;
+   const std::unique_ptr<Value[]> m_ring;
+   const std::uint64_t m_capacity; // the producers' max lead over the slowest locator, not more than the ring capacity
+   const EOverflowPolicy m_overflowPolicy;
+   details::OverflowCounters m_overflowCounters;
+   std::mutex m_mutex; // guards m_retiredLocators and serializes m_locators modifications
+   CopyOnWriteVector<LocatorPtr> m_locators;
+   std::vector<std::weak_ptr<Locator>> m_retiredLocators; // unsubscribed locators which still gate producers while alive
+};
+
+}
@@ -1,38 +1,77 @@
 #pragma once
 
-#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <tuple>
 #include <mutex>
+#include <type_traits>
 
 #include <assert.h>
 
 #include "IValueSource.h"
+#include "CopyOnWriteVector.h"
+#include "PayloadQueue.h"
+#include "Retention.h"
+#include "Stats.h"
+#include "Tracer.h"
 
 namespace MQP
 {
 
-template <typename Key, typename Value>
+/// <summary>
+/// DataManagerFavorSpeed's payload policy: each Locator keeps its own copy of a value
+/// </summary>
+struct PayloadCopied
+{
+   template <typename Value>
+   using Queue = details::CopiedPayloadQueue<Value>;
+};
+
+/// <summary>
+/// DataManagerFavorSpeed's payload policy: the values of an adding are kept once by an immutable refcounted block,
+/// each Locator keeps references to it (see details::SharedPayload)
+/// </summary>
+struct PayloadShared
+{
+   template <typename Value>
+   using Queue = details::SharedPayloadQueue<Value>;
+};
+
+template <typename Key, typename Value, typename TTracer = NoTracer, typename PayloadPolicy = PayloadCopied>
 class DataManagerFavorSpeed;
 
-template <typename Key, typename Value>
-using DataManagerFavorSpeedPtr = std::shared_ptr<DataManagerFavorSpeed<Key, Value>>;
+template <typename Key, typename Value, typename TTracer = NoTracer, typename PayloadPolicy = PayloadCopied>
+using DataManagerFavorSpeedPtr = std::shared_ptr<DataManagerFavorSpeed<Key, Value, TTracer, PayloadPolicy>>;
 
 /// <summary>
 /// The class manages all incoming values and creates instances of IValueSource implementation (see DataManagerFavorSpeed::Locator).
-/// Each Locator copies and keeps incoming value
+/// Each Locator keeps incoming values in its own queue, the queue keeps copies of the values (PayloadCopied)
+/// or references to a single copy shared by all Locators (PayloadShared), the latter saves a copy per consumer for large values.
+/// A Locator's queue has a single reader (the consumer's serialized task), so the reader takes no lock and makes no atomic
+/// read-modify-write, while the producers append under the Locator's lock (see details::SpscQueue).
+/// The count of values kept by each Locator is bounded by RetentionSettings (see EOverflowPolicy).
+/// EOverflowPolicy::block makes a producer wait for room, the reader notifies the waiters after a fenced check of their count,
+/// so a reader which frees no room for a waiter takes no lock.
+/// EOverflowPolicy::dropOldest marks the values to be dropped and the reader skips them at its next reading,
+/// so a value which is being consumed is never dropped, and a reader which stalls keeps at most twice the capacity of values,
+/// then the new values are dropped instead.
+/// TTracer (see Tracer.h) traces the values adding.
 /// </summary>
-template <typename Key, typename Value>
-class DataManagerFavorSpeed : public std::enable_shared_from_this<DataManagerFavorSpeed<Key, Value>>
+template <typename Key, typename Value, typename TTracer, typename PayloadPolicy>
+class DataManagerFavorSpeed : public std::enable_shared_from_this<DataManagerFavorSpeed<Key, Value, TTracer, PayloadPolicy>>
 {
+   static constexpr bool isPayloadShared = std::is_same_v<PayloadPolicy, PayloadShared>;
+
    /// <summary>
    /// The class implements IValueSource interface and controls sequantial reading for one consumer regardless others.
    /// </summary>
-   template <typename Key, typename Value>
-   class Locator : public IValueSource<Key, Value>, public std::enable_shared_from_this<Locator<Key, Value>>
+   class Locator : public IValueSource<Key, Value>, public std::enable_shared_from_this<Locator>
    {
-      friend DataManagerFavorSpeed<Key, Value>;
+      friend DataManagerFavorSpeed;
    public:
-      Locator(DataManagerFavorSpeedPtr<Key, Value> dataManager, IValueSourceConsumerPtr<Key, Value> consumer, const Key& key)
+      Locator(DataManagerFavorSpeedPtr<Key, Value, TTracer, PayloadPolicy> dataManager, IValueSourceConsumerPtr<Key, Value> consumer, const Key& key)
          : m_dataManager(std::move(dataManager))
          , m_consumer(std::move(consumer))
          , m_key(key)
@@ -46,30 +85,60 @@ class DataManagerFavorSpeed : public std::enable_shared_from_this<DataManagerFav
 
       std::tuple<const Key&, const Value&> GetValue() const override
       {
-         std::scoped_lock lock(m_mutex);
-
          assert(!m_values.empty());
+         skipDroppedValues();
          return { m_key, m_values.front() };
       }
 
+      std::tuple<const Key&, ValuesView<Value>> GetValues(std::size_t maxCount) const override
+      {
+         assert(!m_values.empty());
+         skipDroppedValues();
+         return { m_key, m_values.GetRun(maxCount) };
+      }
+
       bool MoveNext() override
       {
-         std::scoped_lock lock(m_mutex);
+         return MoveNext(1);
+      }
+
+      bool MoveNext(std::size_t count) override
+      {
+         m_values.Pop(count);
+
+         if (m_dataManager->m_retention.overflowPolicy == EOverflowPolicy::block)
+         {
+            // the fence pairs with the waiter's one (see makeRoom): either a waiter is seen here or it sees the popped values
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_waitersCount.load(std::memory_order_relaxed) != 0)
+            {
+               std::scoped_lock lock(m_mutex);
+               m_roomAvailable.notify_all();
+            }
+         }
 
-         m_values.pop_front();
          return !m_values.empty();
       }
 
       bool HasValue() const override
       {
-         std::scoped_lock lock(m_mutex);
-
          return !m_values.empty();
       }
 
+      std::size_t GetLag() const override
+      {
+         return getSize();
+      }
+
       void Stop() override
       {
-         m_isStopRequested = true;
+         {
+            // the producers which wait for room are released
+            std::scoped_lock lock(m_mutex);
+            m_isStopRequested = true;
+            m_roomAvailable.notify_all();
+         }
+
          m_dataManager->unsubscribeLocator(shared_from_this());
       }
 
@@ -80,16 +149,188 @@ class DataManagerFavorSpeed : public std::enable_shared_from_this<DataManagerFav
 
    private:
 
-      using std::enable_shared_from_this<Locator<Key, Value>>::shared_from_this;
-      using std::enable_shared_from_this<Locator<Key, Value>>::weak_from_this;
+      using std::enable_shared_from_this<Locator>::shared_from_this;
+      using std::enable_shared_from_this<Locator>::weak_from_this;
 
       void onNewValueAvailable(const Value& value)
       {
          {
-            std::scoped_lock lock(m_mutex);
-            m_values.emplace_back(value);
+            std::unique_lock lock(m_mutex);
+            if (!makeRoom(lock))
+            {
+               return;
+            }
+
+            m_values.Push(value);
+         }
+
+         notifyConsumer();
+      }
+
+      /// <summary>
+      /// Appends copies of values [first, last) under a single lock (EOverflowPolicy::block releases it to wait for room),
+      /// the values are moved in case of isLastCopy and move iterators
+      /// </summary>
+      template <typename ForwardIt>
+      void onNewValuesAvailable(ForwardIt first, ForwardIt last, bool isLastCopy)
+      {
+         {
+            std::unique_lock lock(m_mutex);
+            for (; first != last; ++first)
+            {
+               if (!makeRoom(lock))
+               {
+                  continue;
+               }
+
+               if (isLastCopy)
+               {
+                  m_values.Push(*first);
+               }
+               else
+               {
+                  const auto& value = *first;
+                  m_values.Push(value);
+               }
+            }
+         }
+
+         notifyConsumer();
+      }
+
+      /// <summary>
+      /// Appends the values of a shared payload under a single lock (see PayloadShared), EOverflowPolicy::block releases it
+      /// to wait for room, so the runs appended before the waiting are read by the consumer meanwhile
+      /// </summary>
+      /// <param name="grantedReferencesCount">The payload's references which are granted by the producer, a taken one is subtracted.</param>
+      void onNewPayloadAvailable(details::SharedPayload<Value>& payload, std::uint32_t& grantedReferencesCount)
+      {
+         {
+            std::unique_lock lock(m_mutex);
+            for (std::size_t index = 0; index != payload.Size();)
+            {
+               if (!makeRoom(lock))
+               {
+                  ++index;
+                  continue;
+               }
+
+               // the values which fit the room are appended as a single run
+               const auto room = getRoom();
+               const auto count = std::min(payload.Size() - index, std::max<std::size_t>(room, 1));
+               m_values.Push(payload, index, count, grantedReferencesCount);
+               index += count;
+            }
+         }
+
+         notifyConsumer();
+      }
+
+      /// <summary>
+      /// Gets count of values which can be appended without the overflow policy applying
+      /// </summary>
+      std::size_t getRoom() const
+      {
+         const auto capacity = m_dataManager->m_retention.capacity;
+         const auto size = getSize();
+         return size < capacity ? capacity - size : 0;
+      }
+
+      /// <summary>
+      /// Gets count of values which are kept for the reader, the ones to be dropped are not counted
+      /// </summary>
+      std::size_t getSize() const
+      {
+         const auto head = std::max(m_values.GetPoppedCount(), m_dropUntil.load(std::memory_order_acquire));
+         const auto pushedCount = m_values.GetPushedCount();
+         return pushedCount > head ? static_cast<std::size_t>(pushedCount - head) : 0;
+      }
+
+      /// <summary>
+      /// Pops the values which are dropped by EOverflowPolicy::dropOldest, the reader calls it before a reading,
+      /// so no value which is being consumed is popped. The last value is kept for the reading, as a producer appends
+      /// a new value right after the dropping.
+      /// </summary>
+      void skipDroppedValues() const
+      {
+         const auto dropUntil = m_dropUntil.load(std::memory_order_acquire);
+         const auto poppedCount = m_values.GetPoppedCount();
+         if (dropUntil <= poppedCount)
+         {
+            return;
+         }
+
+         const auto droppedCount = static_cast<std::size_t>(std::min(dropUntil, m_values.GetPushedCount() - 1) - poppedCount);
+         if (droppedCount != 0)
+         {
+            m_values.Pop(droppedCount);
+            details::OverflowCounters::Increment(m_dataManager->m_overflowCounters.droppedOldestCount, droppedCount);
+         }
+      }
+
+      /// <summary>
+      /// Applies the overflow policy in case the capacity is reached. Must be called under the lock,
+      /// EOverflowPolicy::block releases it to notify the consumer and to wait for room.
+      /// EOverflowPolicy::fail is applied by the data manager for all locators in advance, so the value is appended here.
+      /// </summary>
+      /// <returns>Whether a new value can be appended</returns>
+      bool makeRoom(std::unique_lock<std::mutex>& lock)
+      {
+         const auto& retention = m_dataManager->m_retention;
+         if (getSize() < retention.capacity)
+         {
+            return true;
+         }
+
+         auto& counters = m_dataManager->m_overflowCounters;
+
+         switch (retention.overflowPolicy)
+         {
+         case EOverflowPolicy::block:
+         {
+            details::TraceScope<TTracer> trace("DataManagerFavorSpeed::waitForRoom");
+            details::OverflowCounters::Increment(counters.blockedCount);
+
+            // the values appended by a range so far are not notified yet, the consumer has to be scheduled to free room
+            lock.unlock();
+            notifyConsumer();
+            lock.lock();
+
+            // the waiter is published before the room is checked, the fence pairs with the reader's one (see MoveNext),
+            // so the reader which frees room either sees the waiter and notifies it under the lock or it is seen freeing room
+            m_waitersCount.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_roomAvailable.wait(lock, [this, &retention]() { return getSize() < retention.capacity || m_isStopRequested; });
+
+            m_waitersCount.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+         }
+         case EOverflowPolicy::dropOldest:
+         {
+            // the oldest kept value is marked to be dropped, the reader pops it (see skipDroppedValues)
+            const auto poppedCount = m_values.GetPoppedCount();
+            const auto dropUntil = m_dropUntil.load(std::memory_order_relaxed);
+            if (dropUntil < poppedCount + retention.capacity)
+            {
+               m_dropUntil.store(std::max(poppedCount, dropUntil) + 1, std::memory_order_release);
+               return true;
+            }
+
+            // the reader stalls, the values to be dropped are not kept beyond the capacity
+            details::OverflowCounters::Increment(counters.droppedNewestCount);
+            return false;
          }
+         case EOverflowPolicy::dropNewest:
+            details::OverflowCounters::Increment(counters.droppedNewestCount);
+            return false;
+         case EOverflowPolicy::fail:
+         default:
+            return true;
+         }
+      }
 
+      void notifyConsumer()
+      {
          if (auto spConsumer = m_consumer.lock())
          {
             spConsumer->OnNewValueAvailable(shared_from_this());
@@ -98,42 +339,114 @@ class DataManagerFavorSpeed : public std::enable_shared_from_this<DataManagerFav
 
    private:
       std::atomic_bool m_isStopRequested = false;
-      DataManagerFavorSpeedPtr<Key, Value> m_dataManager;
+      DataManagerFavorSpeedPtr<Key, Value, TTracer, PayloadPolicy> m_dataManager;
       const IValueSourceConsumerWeakPtr<Key, Value> m_consumer;
-      mutable std::mutex m_mutex; // guards m_values
-      std::deque<Value> m_values;
+      std::mutex m_mutex; // serializes the producers, they append to m_values and wait for room under it
+      mutable typename PayloadPolicy::template Queue<Value> m_values; // the reader's side is not guarded
+      std::atomic_uint64_t m_dropUntil = 0; // the values before are dropped (EOverflowPolicy::dropOldest), it is written under the lock
+      std::condition_variable m_roomAvailable; // producers wait for room with EOverflowPolicy::block
+      std::atomic_size_t m_waitersCount = 0; // count of producers which wait for room, it is written under the lock
       const Key m_key;
    };
 
-   template <typename Key, typename Value>
-   using LocatorPtr = std::shared_ptr<Locator<Key, Value>>;
-
-   template <typename Key, typename Value>
-   using LocatorWeakPtr = std::weak_ptr<Locator<Key, Value>>;
+   using LocatorPtr = std::shared_ptr<Locator>;
 
 public:
 
-   DataManagerFavorSpeed(Key key) : m_key(std::move(key))
-   {}
+   DataManagerFavorSpeed(Key key, const RetentionSettings& retention = {}) : m_key(std::move(key)), m_retention(retention)
+   {
+      m_retention.capacity = std::max<std::size_t>(m_retention.capacity, 1);
+   }
 
    /// <summary>
-   /// Adds a new value
+   /// Adds a new value, the overflow policy is applied to each locator which has reached the capacity (see RetentionSettings).
+   /// EOverflowPolicy::fail rejects the value in case any locator is full. The room is checked before the adding, not with it,
+   /// so concurrent producers can exceed the capacity by a value each (by the accepted values of a range, see AddValues).
    /// </summary>
+   /// <returns>Whether the value is accepted, i.e. it is not rejected by EOverflowPolicy::fail</returns>
    template <typename TValue>
-   void AddValue(TValue&& value)
+   bool AddValue(TValue&& value)
    {
-      std::vector<LocatorPtr<Key, Value>> locatorsForUpdate;
+      details::TraceScope<TTracer> trace("DataManagerFavorSpeed::AddValue");
+
+      const auto locatorsForUpdate = m_locators.Get();
 
+      if (m_retention.overflowPolicy == EOverflowPolicy::fail && getRoom(*locatorsForUpdate) == 0)
       {
-         std::scoped_lock lock(m_mutex);
+         details::OverflowCounters::Increment(m_overflowCounters.rejectedCount);
+         return false;
+      }
 
-         locatorsForUpdate = m_locators;
+      if constexpr (isPayloadShared)
+      {
+         if constexpr (std::is_lvalue_reference_v<TValue>)
+         {
+            addPayload(*locatorsForUpdate, std::addressof(value), 1);
+         }
+         else
+         {
+            addPayload(*locatorsForUpdate, std::make_move_iterator(std::addressof(value)), 1);
+         }
       }
+      else
+      {
+         for (const auto& locator : *locatorsForUpdate)
+         {
+            locator->onNewValueAvailable(value);
+         }
+      }
+
+      return true;
+   }
+
+   /// <summary>
+   /// Adds new values [first, last), each locator takes all of them under a single lock and is notified once.
+   /// The last locator takes the values by moving in case of move iterators, a shared payload takes them by moving.
+   /// EOverflowPolicy::fail accepts the values while all locators have room and rejects the rest. The room is checked once
+   /// for the range before the adding, so concurrent producers can exceed the capacity by up to a range each.
+   /// </summary>
+   /// <returns>Count of the values which are rejected by EOverflowPolicy::fail</returns>
+   template <typename ForwardIt>
+   std::size_t AddValues(ForwardIt first, ForwardIt last)
+   {
+      if (first == last)
+      {
+         return 0;
+      }
+
+      details::TraceScope<TTracer> trace("DataManagerFavorSpeed::AddValues");
 
-      for (const auto& locator : locatorsForUpdate)
+      const auto locatorsForUpdate = m_locators.Get();
+
+      std::size_t rejectedCount = 0;
+      if (m_retention.overflowPolicy == EOverflowPolicy::fail)
+      {
+         const auto count = static_cast<std::size_t>(std::distance(first, last));
+         const auto acceptedCount = std::min(count, getRoom(*locatorsForUpdate));
+
+         rejectedCount = count - acceptedCount;
+         details::OverflowCounters::Increment(m_overflowCounters.rejectedCount, rejectedCount);
+
+         last = std::next(first, acceptedCount);
+         if (first == last)
+         {
+            return rejectedCount;
+         }
+      }
+
+      if constexpr (isPayloadShared)
+      {
+         addPayload(*locatorsForUpdate, first, static_cast<std::size_t>(std::distance(first, last)));
+      }
+      else
       {
-         locator->onNewValueAvailable(value);
+         for (auto itLocator = std::begin(*locatorsForUpdate); itLocator != std::end(*locatorsForUpdate); ++itLocator)
+         {
+            (*itLocator)->onNewValuesAvailable(first, last, std::next(itLocator) == std::end(*locatorsForUpdate));
+         }
       }
+
+      return rejectedCount;
    }
 
    /// <summary>
@@ -143,44 +456,89 @@ public:
    {
       std::scoped_lock lock(m_mutex);
 
-      return m_locators.emplace_back(std::make_shared<Locator<Key, Value>>(shared_from_this(), std::move(consumer), m_key));
+      return m_locators.Add(std::make_shared<Locator>(shared_from_this(), std::move(consumer), m_key));
+   }
+
+   /// <summary>
+   /// Gets the values storage statistics, the values are kept by the locators
+   /// </summary>
+   DataManagerStats GetStats() const
+   {
+      DataManagerStats stats;
+
+      for (const auto& locator : *m_locators.Get())
+      {
+         stats.retainedValuesCount += locator->GetLag();
+      }
+
+      stats.retainedBytes = stats.retainedValuesCount * sizeof(Value); // a shared value is counted per consumer as well
+      stats.overflow = m_overflowCounters.Get();
+      return stats;
    }
 
-   using std::enable_shared_from_this<DataManagerFavorSpeed<Key, Value>>::shared_from_this;
+   using std::enable_shared_from_this<DataManagerFavorSpeed<Key, Value, TTracer, PayloadPolicy>>::shared_from_this;
 
 private:
 
+   /// <summary>
+   /// Makes a shared payload of count values from first and passes it to the locators.
+   /// Each locator is granted a reference in advance, the creator's reference and the unused grants are released at once.
+   /// </summary>
+   template <typename InputIt>
+   static void addPayload(const std::vector<LocatorPtr>& locators, InputIt first, std::size_t count)
+   {
+      if (locators.empty())
+      {
+         return;
+      }
+
+      auto grantedReferencesCount = static_cast<std::uint32_t>(locators.size());
+      auto* payload = details::SharedPayload<Value>::Create(first, count, grantedReferencesCount + 1);
+
+      for (const auto& locator : locators)
+      {
+         locator->onNewPayloadAvailable(*payload, grantedReferencesCount);
+      }
+
+      payload->Release(grantedReferencesCount + 1);
+   }
+
+   /// <summary>
+   /// Gets count of values which all locators have room for
+   /// </summary>
+   std::size_t getRoom(const std::vector<LocatorPtr>& locators) const
+   {
+      auto room = m_retention.capacity;
+      for (const auto& locator : locators)
+      {
+         room = std::min(room, locator->getRoom());
+      }
+
+      return room;
+   }
+
    /// <summary>
    /// Unsubscribe the passed locator from updates
    /// The method still keeps available Locator::GetValue method correct work
    /// </summary>
-   void unsubscribeLocator(LocatorPtr<Key, Value> locator)
+   void unsubscribeLocator(LocatorPtr locator)
    {
-      LocatorPtr<Key, Value> unsubscribedLocator;
+      LocatorPtr unsubscribedLocator;
 
       {
          std::scoped_lock lock(m_mutex);
 
-         auto itUnsubscribedLocator = std::find_if(std::begin(m_locators), std::end(m_locators), [&locator](const auto& loc)
-            {
-               return loc == locator;
-            });
-
-         if (itUnsubscribedLocator == std::end(m_locators))
-         {
-            assert(false); 
-            return;
-         }
-
-         unsubscribedLocator = std::move(*itUnsubscribedLocator); // destroying out of the lock
-         m_locators.erase(itUnsubscribedLocator);
+         unsubscribedLocator = m_locators.Remove(locator); // destroying out of the lock
+         assert(unsubscribedLocator);
       }
    }
 
 private:
-   mutable std::mutex m_mutex; // guards m_values and m_locators
+   mutable std::mutex m_mutex; // serializes m_locators modifications
    const Key m_key;
-   std::vector<LocatorPtr<Key, Value>> m_locators;
+   RetentionSettings m_retention;
+   details::OverflowCounters m_overflowCounters;
+   CopyOnWriteVector<LocatorPtr> m_locators;
 };
 
 }
\ No newline at end of file
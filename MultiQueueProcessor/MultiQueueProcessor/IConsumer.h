@@ -2,6 +2,8 @@
 
 #include <memory>
 
+#include "ValuesView.h"
+
 namespace MQP
 {
 
@@ -17,4 +19,20 @@ struct IConsumer
 template<typename Key, typename Value>
 using IConsumerPtr = std::shared_ptr<IConsumer<Key, Value>>;
 
+/// <summary>
+/// The batch consumer's interface. MultiQueueProcessor detects it and passes the values available for a key 
+/// by batches right from the values storage, the values order of a key is kept.
+/// The values of a batch are valid only during the ConsumeBatch call.
+/// </summary>
+template<typename Key, typename Value>
+struct IBatchConsumer : IConsumer<Key, Value>
+{
+   virtual void ConsumeBatch(const Key& id, const ValuesView<Value>& values) noexcept = 0;
+
+   void Consume(const Key& id, const Value& value) noexcept override
+   {
+      ConsumeBatch(id, ValuesView<Value>(&value, 1));
+   }
+};
+
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <memory>
+#include <tuple>
+
+#include "ValuesView.h"
 
 namespace MQP
 {
@@ -20,7 +23,7 @@ template <typename Key, typename Value>
 class IValueSourceConsumer
 {
 public:
-   virtual ~IValueSourceConsumer() = 0 {}
+   virtual ~IValueSourceConsumer() = default;
 
    /// <summary>
    /// A new available value handler.
@@ -40,24 +43,42 @@ template <typename Key, typename Value>
 class IValueSource
 {
 public:
-   virtual ~IValueSource() = 0 {}
+   virtual ~IValueSource() = default;
 
    /// <summary>
    /// Gets a current value
    /// </summary>
    virtual std::tuple<const Key&, const Value&> GetValue() const = 0;
 
+   /// <summary>
+   /// Gets available values starting from the current one, which are laid out in the source's storage with a fixed stride.
+   /// At least one value is returned in case a value is available. The values stay valid till the source is moved over them.
+   /// </summary>
+   /// <param name="maxCount">Max count of the returned values.</param>
+   virtual std::tuple<const Key&, ValuesView<Value>> GetValues(std::size_t maxCount) const = 0;
+
    /// <summary>
    /// Checks whether a value is available in a source
    /// </summary>
    virtual bool HasValue() const = 0;
 
+   /// <summary>
+   /// Gets count of values which are available but not consumed yet, i.e. the source's lag behind the key's tail
+   /// </summary>
+   virtual std::size_t GetLag() const = 0;
+
    /// <summary>
    /// Moves a source to the next value
    /// </summary>
    /// <returns>Whether a value is available after the completed movement</returns>
    virtual bool MoveNext() = 0;
 
+   /// <summary>
+   /// Moves a source over the passed count of values, which must be available (see GetValues)
+   /// </summary>
+   /// <returns>Whether a value is available after the completed movement</returns>
+   virtual bool MoveNext(std::size_t count) = 0;
+
    /// <summary>
    /// Deactivates a value source. Must be called by the interface consumer before desctruction.
    /// </summary>
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+namespace MQP
+{
+
+/// <summary>
+/// A thread pool's idle worker policy.
+/// An idle worker busy-polls its queues for the spin interval and then parks (blocks on a condition variable).
+/// Spinning makes a wakeup after a short idle period cost nanoseconds instead of microseconds of a thread wakeup,
+/// at the cost of a busy core.
+/// </summary>
+struct ThreadPoolIdlePolicy
+{
+   // time which an idle worker busy-polls its queues before parking, zero means parking at once
+   std::chrono::nanoseconds spinInterval = std::chrono::nanoseconds::zero();
+};
+
+namespace details
+{
+
+/// <summary>
+/// Hints the CPU that the thread is spinning (lets a sibling hyper-thread run and saves power)
+/// </summary>
+inline void CpuRelax()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+   _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+   __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+   __asm__ __volatile__("yield");
+#endif
+}
+
+/// <summary>
+/// Busy-polls the condition for the interval
+/// </summary>
+/// <returns>Whether the condition has become true</returns>
+template <typename Condition>
+bool SpinUntil(std::chrono::nanoseconds interval, Condition&& condition)
+{
+   if (interval <= std::chrono::nanoseconds::zero())
+   {
+      return false;
+   }
+
+   constexpr unsigned clockCheckPeriod = 64; // the clock is read once per the count of polls
+
+   const auto deadline = std::chrono::steady_clock::now() + interval;
+   for (unsigned polls = 1; ; ++polls)
+   {
+      if (condition())
+      {
+         return true;
+      }
+
+      if (polls % clockCheckPeriod == 0 && std::chrono::steady_clock::now() >= deadline)
+      {
+         return false;
+      }
+
+      CpuRelax();
+   }
+}
+
+}
+
+}
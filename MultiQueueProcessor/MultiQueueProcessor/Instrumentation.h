@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+
+#include "IConsumer.h"
+#include "LatencyHistogram.h"
+
+namespace MQP
+{
+
+/// <summary>
+/// MultiQueueProcessor's instrumentation policy: no instrumentation, values are stored as is
+/// </summary>
+struct NoInstrumentation
+{
+   static constexpr bool isEnabled = false;
+
+   template <typename Value>
+   using StoredValue = Value;
+};
+
+/// <summary>
+/// A value which is stored with its enqueuing time
+/// </summary>
+template <typename Value>
+struct StampedValue
+{
+   Value value;
+   std::chrono::steady_clock::time_point enqueueTime;
+};
+
+/// <summary>
+/// MultiQueueProcessor's instrumentation policy: each value is stamped when it is enqueued,
+/// so a consumer call records enqueue->dispatch and dispatch->consume-complete latencies (see LatencyHistograms).
+/// </summary>
+struct LatencyInstrumentation
+{
+   static constexpr bool isEnabled = true;
+
+   template <typename Value>
+   using StoredValue = StampedValue<Value>;
+};
+
+/// <summary>
+/// Latency histograms of consumed values
+/// </summary>
+struct LatencyHistograms
+{
+   // from Enqueue till the consumer call which gets the value is started
+   LatencyHistogram enqueueToDispatch;
+   // from the start till the end of the consumer call which gets the value (a whole batch for IBatchConsumer)
+   LatencyHistogram dispatchToConsumed;
+
+   void Merge(const LatencyHistograms& other)
+   {
+      enqueueToDispatch.Merge(other.enqueueToDispatch);
+      dispatchToConsumed.Merge(other.dispatchToConsumed);
+   }
+
+   void Reset()
+   {
+      enqueueToDispatch.Reset();
+      dispatchToConsumed.Reset();
+   }
+};
+
+/// <summary>
+/// A snapshot of latency histograms of the current subscriptions (see MultiQueueProcessor::GetLatencySnapshot)
+/// </summary>
+template <typename Key, typename Value, typename Hash>
+struct LatencySnapshot
+{
+   // per key, merged over the key's consumers
+   std::unordered_map<Key, LatencyHistograms, Hash> keys;
+   // per consumer, merged over the consumer's keys
+   std::unordered_map<IConsumerPtr<Key, Value>, LatencyHistograms> consumers;
+};
+
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace MQP
+{
+
+/// <summary>
+/// An HDR-style (log-linear) histogram of latencies in nanoseconds.
+/// Values below subBucketsCount are counted exactly, greater ones fall into buckets of a power of two range split into
+/// subBucketsCount linear sub-buckets, so a value is kept with the relative precision of 1 / subBucketsCount (~3%)
+/// whatever its magnitude is. The counts array grows up to the greatest recorded value only (~7 KB for a second).
+/// The histogram is not thread safe.
+/// </summary>
+class LatencyHistogram
+{
+   static constexpr unsigned subBucketBits = 5;
+   static constexpr std::uint64_t subBucketsCount = std::uint64_t{ 1 } << subBucketBits;
+
+public:
+   /// <summary>
+   /// Records a value
+   /// </summary>
+   /// <param name="value">A latency in nanoseconds</param>
+   /// <param name="count">Count of the value's occurrences</param>
+   void Record(std::uint64_t value, std::uint64_t count = 1)
+   {
+      if (count == 0)
+      {
+         return;
+      }
+
+      const auto index = getIndex(value);
+      if (index >= m_counts.size())
+      {
+         m_counts.resize(index + 1, 0);
+      }
+
+      m_counts[index] += count;
+      m_totalCount += count;
+      m_sum += static_cast<double>(value) * count;
+      m_min = std::min(m_min, value);
+      m_max = std::max(m_max, value);
+   }
+
+   /// <summary>
+   /// Adds all values of another histogram
+   /// </summary>
+   void Merge(const LatencyHistogram& other)
+   {
+      if (other.m_totalCount == 0)
+      {
+         return;
+      }
+
+      if (other.m_counts.size() > m_counts.size())
+      {
+         m_counts.resize(other.m_counts.size(), 0);
+      }
+
+      for (std::size_t i = 0; i < other.m_counts.size(); ++i)
+      {
+         m_counts[i] += other.m_counts[i];
+      }
+
+      m_totalCount += other.m_totalCount;
+      m_sum += other.m_sum;
+      m_min = std::min(m_min, other.m_min);
+      m_max = std::max(m_max, other.m_max);
+   }
+
+   /// <summary>
+   /// Removes all values, the counts array keeps its capacity
+   /// </summary>
+   void Reset()
+   {
+      std::fill(std::begin(m_counts), std::end(m_counts), 0);
+      m_totalCount = 0;
+      m_sum = 0;
+      m_min = std::numeric_limits<std::uint64_t>::max();
+      m_max = 0;
+   }
+
+   std::uint64_t GetCount() const
+   {
+      return m_totalCount;
+   }
+
+   std::uint64_t GetMin() const
+   {
+      return m_totalCount != 0 ? m_min : 0;
+   }
+
+   std::uint64_t GetMax() const
+   {
+      return m_max;
+   }
+
+   double GetMean() const
+   {
+      return m_totalCount != 0 ? m_sum / m_totalCount : 0;
+   }
+
+   /// <summary>
+   /// Gets a value at a percentile, i.e. the greatest value of the bucket which the percentile falls into
+   /// (but not greater than the max recorded value)
+   /// </summary>
+   /// <param name="percentile">A percentile in [0, 100]</param>
+   std::uint64_t GetValueAtPercentile(double percentile) const
+   {
+      if (m_totalCount == 0)
+      {
+         return 0;
+      }
+
+      const auto fraction = std::clamp(percentile, 0.0, 100.0) / 100;
+      const auto rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(fraction * m_totalCount + 0.5));
+
+      std::uint64_t count = 0;
+      for (std::size_t i = 0; i < m_counts.size(); ++i)
+      {
+         count += m_counts[i];
+         if (count >= rank)
+         {
+            return std::min(getHighestValue(i), m_max);
+         }
+      }
+
+      return m_max;
+   }
+
+private:
+   static std::size_t getIndex(std::uint64_t value)
+   {
+      if (value < subBucketsCount)
+      {
+         return static_cast<std::size_t>(value);
+      }
+
+      unsigned msb = 0;
+      for (auto v = value; v > 1; v >>= 1)
+      {
+         ++msb;
+      }
+
+      // the value is in [subBucketsCount << bucket, subBucketsCount << (bucket + 1)), a sub-bucket's width is 1 << bucket
+      const auto bucket = msb - subBucketBits;
+      return static_cast<std::size_t>(subBucketsCount * (bucket + 1) + ((value >> bucket) - subBucketsCount));
+   }
+
+   static std::uint64_t getHighestValue(std::size_t index)
+   {
+      if (index < subBucketsCount)
+      {
+         return index;
+      }
+
+      const auto bucket = index / subBucketsCount - 1;
+      const auto subBucket = index % subBucketsCount + subBucketsCount;
+      return ((subBucket + 1) << bucket) - 1;
+   }
+
+private:
+   std::vector<std::uint64_t> m_counts;
+   std::uint64_t m_totalCount = 0;
+   double m_sum = 0;
+   std::uint64_t m_min = std::numeric_limits<std::uint64_t>::max();
+   std::uint64_t m_max = 0;
+};
+
+}
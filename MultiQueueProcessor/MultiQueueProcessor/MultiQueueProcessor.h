@@ -2,13 +2,25 @@
 
 #include <unordered_map>
 #include <shared_mutex>
+#include <mutex>
 #include <memory>
 #include <vector>
+#include <iterator>
 #include <type_traits>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
 
 #include "ConsumerProcessor.h"
 #include "DataManager.h"
 #include "DataManagerFavorSpeed.h"
+#include "DataManagerFavorLatency.h"
+#include "DataManagerConflating.h"
+#include "Instrumentation.h"
+#include "Retention.h"
+#include "Stats.h"
+#include "Tracer.h"
 
 namespace MQP
 {
@@ -16,29 +28,177 @@ namespace MQP
 /// <summary>
 /// MultiQueueProcessor's data management strategies
 /// </summary>
-enum class ETuning {size /*DataManager*/, speed /*DataManagerFavorSpeed*/};
+enum class ETuning {size /*DataManager*/, speed /*DataManagerFavorSpeed*/, latency /*DataManagerFavorLatency*/, conflate /*DataManagerConflating*/,
+                    share /*DataManagerFavorSpeed with PayloadShared*/};
 
 /// <summary>
-/// Multi queue processor
+/// MultiQueueProcessor's settings
 /// </summary>
-template<typename Key, typename Value, typename TPool, ETuning TUNING, typename Hash = std::hash<typename Key>>
+struct MultiQueueProcessorSettings
+{
+   // count of independently locked key registry shards (rounded up to a power of two),
+   // keys of different shards are enqueued and subscribed to without touching the same locks
+   std::size_t keyRegistryShardsCount = 16;
+   // the keys' values retention, unless a subscription passes its own (see MultiQueueProcessor::Subscribe),
+   // a history here keeps every enqueued key registered for good (see RetentionSettings::historyCount)
+   RetentionSettings retention;
+   // consumers notification settings
+   ConsumerProcessorSettings consumerProcessorSettings;
+};
+
+/// <summary>
+/// Multi queue processor.
+/// TInstrumentation is NoInstrumentation or LatencyInstrumentation, the latter stamps each enqueued value and records
+/// enqueue->dispatch and dispatch->consume-complete latencies per key and per consumer (see GetLatencySnapshot).
+/// TTracer is NoTracer (the hooks compile away) or ChromeTracer, the latter records the subscribing, the enqueuing,
+/// the data managers' work, the consumers' tasks and calls as trace events (see Tracer.h), a key's events have the key's hash as id.
+/// </summary>
+template<typename Key, typename Value, typename TPool, ETuning TUNING, typename Hash = std::hash<Key>, typename TInstrumentation = NoInstrumentation,
+         typename TTracer = NoTracer>
 class MultiQueueProcessor
 {
    enum {dataManager, subscribersToKey};
 
+   /// <summary>
+   /// A value as it is kept by a data manager, stamped in case of LatencyInstrumentation
+   /// </summary>
+   using StoredValue = typename TInstrumentation::template StoredValue<Value>;
+
    /// <summary>
    /// "Data manager" class selection 
    /// </summary>
-   using KeyDataManager = std::conditional_t<TUNING == ETuning::size, DataManager<Key, Value>, DataManagerFavorSpeed<Key, Value>>;
+   using KeyDataManager = std::conditional_t<TUNING == ETuning::size, DataManager<Key, StoredValue, StorageSegmented<>, TTracer>,
+                          std::conditional_t<TUNING == ETuning::speed, DataManagerFavorSpeed<Key, StoredValue, TTracer>,
+                          std::conditional_t<TUNING == ETuning::latency, DataManagerFavorLatency<Key, StoredValue, defaultRingCapacity, TTracer>,
+                          std::conditional_t<TUNING == ETuning::share, DataManagerFavorSpeed<Key, StoredValue, TTracer, PayloadShared>,
+                                                                       DataManagerConflating<Key, StoredValue, TTracer>>>>>;
    using KeyDataManagerPtr = std::shared_ptr<KeyDataManager>;
 
+   // the least size of a shard's publishedDataManagers which is swept for the keys which have lost their publishers
+   static constexpr std::size_t minPublishedSweepSize = 16;
+
+   /// <summary>
+   /// A part of the key registry, a key belongs to a shard by its hash
+   /// </summary>
+   struct alignas(64) KeyRegistryShard
+   {
+      std::shared_mutex mutex; // guards dataManagers, publishedDataManagers and publishedSweepSize
+      std::unordered_map<Key, std::tuple<KeyDataManagerPtr, std::vector<IConsumerPtr<Key, Value>>>, Hash> dataManagers;
+      std::unordered_map<Key, std::weak_ptr<KeyDataManager>, Hash> publishedDataManagers; // data managers pinned by publishers
+      std::size_t publishedSweepSize = minPublishedSweepSize; // publishedDataManagers' size which triggers its next sweep
+   };
+
+   /// <summary>
+   /// A forward iterator over the values of a key's EnqueueBatch items, it walks the iterators to the items,
+   /// so a data manager takes the values right from the caller's range
+   /// </summary>
+   template <typename ItemIt>
+   class BatchValuesIterator
+   {
+   public:
+      using iterator_category = std::forward_iterator_tag;
+      using reference = decltype(std::get<1>(**std::declval<ItemIt>()));
+      using value_type = std::decay_t<reference>;
+      using pointer = std::add_pointer_t<std::remove_reference_t<reference>>;
+      using difference_type = std::ptrdiff_t;
+
+      BatchValuesIterator() = default;
+
+      explicit BatchValuesIterator(ItemIt item) : m_item(item)
+      {}
+
+      reference operator*() const
+      {
+         return std::get<1>(**m_item);
+      }
+
+      BatchValuesIterator& operator++()
+      {
+         ++m_item;
+         return *this;
+      }
+
+      BatchValuesIterator operator++(int)
+      {
+         auto result = *this;
+         ++m_item;
+         return result;
+      }
+
+      bool operator==(const BatchValuesIterator& other) const
+      {
+         return m_item == other.m_item;
+      }
+
+      bool operator!=(const BatchValuesIterator& other) const
+      {
+         return m_item != other.m_item;
+      }
+
+   private:
+      ItemIt m_item{};
+   };
+
 public:
+   /// <summary>
+   /// A pre-resolved handle for enqueuing values for a single key (see MultiQueueProcessor::GetPublisher).
+   /// The handle pins the key's data manager, so enqueuing costs neither a key lookup nor a registry lock.
+   /// Values enqueued while the key has no subscribers are dropped unless the key keeps a history, as for MultiQueueProcessor::Enqueue.
+   /// </summary>
+   class Publisher
+   {
+      friend MultiQueueProcessor;
+   public:
+      Publisher() = default;
+
+      /// <summary>
+      /// Enqueues a value for the publisher's key (see MultiQueueProcessor::Enqueue).
+      /// </summary>
+      template <typename TValue>
+      bool Enqueue(TValue&& value) const
+      {
+         details::TraceScope<TTracer> trace("Publisher::Enqueue");
+
+         assert(m_dataManager);
+         return m_dataManager->AddValue(makeStoredValue(std::forward<TValue>(value)));
+      }
+
+      /// <summary>
+      /// Enqueues values [first, last) for the publisher's key (see MultiQueueProcessor::EnqueueRange).
+      /// </summary>
+      template <typename ForwardIt>
+      std::size_t EnqueueRange(ForwardIt first, ForwardIt last) const
+      {
+         details::TraceScope<TTracer> trace("Publisher::EnqueueRange");
+
+         assert(m_dataManager);
+         return first != last ? addValues(*m_dataManager, first, last) : 0;
+      }
+
+      explicit operator bool() const
+      {
+         return static_cast<bool>(m_dataManager);
+      }
+
+   private:
+      explicit Publisher(KeyDataManagerPtr dataManager) : m_dataManager(std::move(dataManager))
+      {}
+
+   private:
+      KeyDataManagerPtr m_dataManager;
+   };
+
    /// <summary>
    /// Ctor
    /// </summary>
    /// <param name="threadPool">A thread pool that is used for the consumers notification tasks execution.</param>
-   MultiQueueProcessor(std::shared_ptr<TPool> threadPool)
-      : m_threadPool(std::move(threadPool))
+   /// <param name="settings">The processor's settings.</param>
+   MultiQueueProcessor(std::shared_ptr<TPool> threadPool, const MultiQueueProcessorSettings& settings = {})
+      : m_shardIndexShift(getShardIndexShift(settings.keyRegistryShardsCount))
+      , m_shards(std::make_unique<KeyRegistryShard[]>(std::size_t{ 1 } << (64 - m_shardIndexShift)))
+      , m_retention(settings.retention)
+      , m_consumerProcessorSettings(settings.consumerProcessorSettings)
+      , m_threadPool(std::move(threadPool))
    {}
 
    MultiQueueProcessor(const MultiQueueProcessor&) = delete;
@@ -55,40 +215,86 @@ public:
    /// the thread pool implementation, passed to MultiQueueProcessor.
    /// It is not guaranteed that the consumer which is subscribed to different keys will be notified sequentially
    /// about all enqueued values for that keys. The current implementation provides only "intra key" sequential notifications.
+   /// The key's values retention is the processor's one (see MultiQueueProcessorSettings::retention).
    /// </summary>
    void Subscribe(const Key& key, IConsumerPtr<Key, Value> consumer)
+   {
+      Subscribe(key, std::move(consumer), m_retention);
+   }
+
+   /// <summary>
+   /// Subscribes a consumer to value notifications by the key starting from the key's history (see SubscriptionSettings).
+   /// The key's values retention is the processor's one (see MultiQueueProcessorSettings::retention).
+   /// </summary>
+   void Subscribe(const Key& key, IConsumerPtr<Key, Value> consumer, const SubscriptionSettings& subscription)
+   {
+      Subscribe(key, std::move(consumer), m_retention, subscription);
+   }
+
+   /// <summary>
+   /// Subscribes a consumer to value notifications by the key with the key's values retention settings.
+   /// The retention is applied in case the key has neither subscribers nor publishers yet, otherwise the key keeps its retention.
+   /// A key which keeps a history (see RetentionSettings::historyCount) stays registered without subscribers, so a late subscriber
+   /// can replay it (ETuning::size only, the other tunings always start from EStartPosition::now).
+   /// </summary>
+   void Subscribe(const Key& key, IConsumerPtr<Key, Value> consumer, const RetentionSettings& retention, const SubscriptionSettings& subscription = {})
    {
       if (!consumer)
       {
          return;
       }
 
-      std::scoped_lock lock(m_mutex);
+      details::TraceScope<TTracer> trace("MultiQueueProcessor::Subscribe", traceId(key));
+
+      IValueSourceConsumerPtr<Key, StoredValue> valueSourceConsumer;
+      IValueSourcePtr<Key, StoredValue> valueSource;
 
-      auto itDataManager = m_dataManagers.find(key);
-      if (itDataManager == std::end(m_dataManagers))
-      {
-         auto it = m_dataManagers.try_emplace(key, std::make_shared<KeyDataManager>(key), std::vector<IConsumerPtr<Key, Value>>{consumer});
-         assert(it.second);
-         itDataManager = it.first;
-      }
-      else
       {
-         auto& subscribers = std::get<subscribersToKey>(itDataManager->second);
-         if (std::find(std::begin(subscribers), std::end(subscribers), consumer) != std::end(subscribers))
+         auto& shard = getShard(key);
+         std::scoped_lock lock(shard.mutex);
+
+         auto itDataManager = shard.dataManagers.find(key);
+         if (itDataManager == std::end(shard.dataManagers))
          {
-            // this consumer has already been subscribed to the passed key, prevent a double subscription
-            return;
+            // the key's publishers and subscribers must share the same data manager
+            auto keyDataManager = findPublishedDataManager(shard, key);
+            if (!keyDataManager)
+            {
+               keyDataManager = std::make_shared<KeyDataManager>(key, retention);
+            }
+
+            auto it = shard.dataManagers.try_emplace(key, std::move(keyDataManager), std::vector<IConsumerPtr<Key, Value>>{consumer});
+            assert(it.second);
+            itDataManager = it.first;
          }
+         else
+         {
+            auto& subscribers = std::get<subscribersToKey>(itDataManager->second);
+            if (std::find(std::begin(subscribers), std::end(subscribers), consumer) != std::end(subscribers))
+            {
+               // this consumer has already been subscribed to the passed key, prevent a double subscription
+               return;
+            }
 
-         subscribers.emplace_back(consumer);
-      }
+            subscribers.emplace_back(consumer);
+         }
+
+         std::scoped_lock consumersLock(m_consumerProcessorsMutex);
 
-      auto [itConsumerProcessor, isInserted] = 
-         m_consumerProcessors.emplace(consumer, std::make_shared<ConsumerProcessor<Key, Value, TPool, Hash>>(consumer, m_threadPool));
+         auto [itConsumerProcessor, isInserted] = 
+            m_consumerProcessors.emplace(consumer, std::make_shared<ConsumerProcessor<Key, Value, TPool, Hash, TInstrumentation, TTracer>>(consumer, m_threadPool, m_consumerProcessorSettings));
 
-      // create and add a new value source to an existed consumer processor
-      itConsumerProcessor->second->AddValueSource(key, std::get<dataManager>(itDataManager->second)->CreateValueSource(itConsumerProcessor->second));
+         // create and add a new value source to an existed consumer processor
+         valueSourceConsumer = itConsumerProcessor->second->CreateValueSourceConsumer();
+         valueSource = createValueSource(*std::get<dataManager>(itDataManager->second), valueSourceConsumer, subscription);
+         itConsumerProcessor->second->AddValueSource(key, valueSource, valueSourceConsumer);
+      }
+
+      // the replayed history is announced out of the locks, as the consumer can be called right in this thread
+      if (valueSource->HasValue())
+      {
+         valueSourceConsumer->OnNewValueAvailable(valueSource);
+      }
    }
 
    /// <summary>
@@ -98,17 +304,11 @@ public:
    /// </summary>
    void Unsubscribe(const Key& key, IConsumerPtr<Key, Value> consumer)
    {
-      std::scoped_lock lock(m_mutex);
-
-      const auto itConsumerProcessor = m_consumerProcessors.find(consumer);
-      if (itConsumerProcessor == std::end(m_consumerProcessors))
-      {
-         // there is no such consumer
-         return;
-      }
+      auto& shard = getShard(key);
+      std::scoped_lock lock(shard.mutex);
 
-      auto itDataManager = m_dataManagers.find(key);
-      if (itDataManager == std::end(m_dataManagers))
+      auto itDataManager = shard.dataManagers.find(key);
+      if (itDataManager == std::end(shard.dataManagers))
       {
          // there is no such key
          return;
@@ -119,17 +319,28 @@ public:
       auto itSubscriberToKey = std::find(std::begin(subscribers), std::end(subscribers), consumer);
       if (itSubscriberToKey == std::end(subscribers))
       {
-         // this subscriber is not subscribed to the passed key
-         assert(false);
+         // this consumer is not subscribed to the passed key, it is an error unless the consumer is not subscribed at all
+         std::scoped_lock consumersLock(m_consumerProcessorsMutex);
+         assert(m_consumerProcessors.find(consumer) == std::end(m_consumerProcessors));
          return;
       }
 
       subscribers.erase(itSubscriberToKey);
 
-      if (subscribers.empty())
+      if (subscribers.empty() && !isHistoryRetained(*std::get<dataManager>(itDataManager->second)))
       {
          // there are no subscribers to the key, it's time to remove it
-         m_dataManagers.erase(itDataManager);
+         shard.dataManagers.erase(itDataManager);
+      }
+
+      std::scoped_lock consumersLock(m_consumerProcessorsMutex);
+
+      const auto itConsumerProcessor = m_consumerProcessors.find(consumer);
+      if (itConsumerProcessor == std::end(m_consumerProcessors))
+      {
+         // a subscribed consumer must have a processor
+         assert(false);
+         return;
       }
 
       auto consumerProcessor = itConsumerProcessor->second;
@@ -141,33 +352,485 @@ public:
       }
    }
 
+   /// <summary>
+   /// Gets a publisher for a key, it enqueues values for the key bypassing the key lookup.
+   /// The publisher stays valid regardless of subscriptions and unsubscriptions to the key.
+   /// A key which has no subscribers gets the processor's retention (see MultiQueueProcessorSettings::retention),
+   /// the key is registered in case the retention keeps a history.
+   /// </summary>
+   Publisher GetPublisher(const Key& key)
+   {
+      auto& shard = getShard(key);
+      std::scoped_lock lock(shard.mutex);
+
+      auto keyDataManager = findPublishedDataManager(shard, key);
+      if (keyDataManager)
+      {
+         return Publisher(std::move(keyDataManager));
+      }
+
+      auto itDataManager = shard.dataManagers.find(key);
+      if (itDataManager == std::end(shard.dataManagers) && isHistoryRetained(m_retention))
+      {
+         itDataManager = shard.dataManagers.try_emplace(key, std::make_shared<KeyDataManager>(key, m_retention), std::vector<IConsumerPtr<Key, Value>>{}).first;
+      }
+
+      keyDataManager = (itDataManager != std::end(shard.dataManagers)) ? std::get<dataManager>(itDataManager->second) 
+                                                                       : std::make_shared<KeyDataManager>(key, m_retention);
+
+      // forget the data managers of the keys which have lost all their publishers, the map is swept once it has doubled
+      // since the last sweep, so the sweeps are amortized O(1) per a new publisher's key
+      if (shard.publishedDataManagers.size() >= shard.publishedSweepSize)
+      {
+         for (auto it = std::begin(shard.publishedDataManagers); it != std::end(shard.publishedDataManagers);)
+         {
+            it = it->second.expired() ? shard.publishedDataManagers.erase(it) : std::next(it);
+         }
+
+         shard.publishedSweepSize = std::max(2 * shard.publishedDataManagers.size(), minPublishedSweepSize);
+      }
+
+      shard.publishedDataManagers.insert_or_assign(key, keyDataManager);
+
+      return Publisher(std::move(keyDataManager));
+   }
+
    /// <summary>
    /// Enqueues a value for a key.
+   /// The key's overflow policy is applied in case its consumers lag by the retention capacity (see RetentionSettings).
+   /// The value is dropped in case the key has no subscribers, unless the processor's retention keeps a history.
+   /// </summary>
+   /// <returns>Whether the value is accepted, i.e. it is not rejected by EOverflowPolicy::fail</returns>
+   template <typename TValue>
+   bool Enqueue(const Key& key, TValue&& value)
+   {
+      details::TraceScope<TTracer> trace("MultiQueueProcessor::Enqueue", traceId(key));
+
+      if (auto keyDataManager = findDataManager(key))
+      {
+         return keyDataManager->AddValue(makeStoredValue(std::forward<TValue>(value)));
+      }
+
+      return true;
+   }
+
+   /// <summary>
+   /// Enqueues values [first, last) for a key.
+   /// The key is looked up once, the values are added under a single data manager lock and each subscriber 
+   /// is notified once about the whole range. Pass move iterators (std::make_move_iterator) to move the values.
+   /// </summary>
+   /// <returns>Count of the values which are rejected by EOverflowPolicy::fail</returns>
+   template <typename ForwardIt>
+   std::size_t EnqueueRange(const Key& key, ForwardIt first, ForwardIt last)
+   {
+      if (first == last)
+      {
+         return 0;
+      }
+
+      details::TraceScope<TTracer> trace("MultiQueueProcessor::EnqueueRange", traceId(key));
+
+      if (auto keyDataManager = findDataManager(key))
+      {
+         return addValues(*keyDataManager, first, last);
+      }
+
+      return 0;
+   }
+
+   /// <summary>
+   /// Enqueues a batch of key-value pairs [first, last) (std::pair<Key, Value> or another tuple-like type).
+   /// The keys are resolved under a single lock of each involved registry shard, the values are grouped per key keeping their order,
+   /// then each group is added under a single data manager lock and each subscriber is notified once per group.
+   /// Pass move iterators (std::make_move_iterator) to move the values.
+   /// </summary>
+   /// <returns>Count of the values which are rejected by EOverflowPolicy::fail</returns>
+   template <typename ForwardIt>
+   std::size_t EnqueueBatch(ForwardIt first, ForwardIt last)
+   {
+      details::TraceScope<TTracer> trace("MultiQueueProcessor::EnqueueBatch");
+
+      constexpr auto noGroup = std::numeric_limits<std::size_t>::max();
+
+      // the items are bucketed by their shards in one pass keeping their order (a counting sort), the bucket of a shard
+      // is [shardItemsBegin[shardIndex], shardItemsBegin[shardIndex + 1]) of items
+      std::vector<std::size_t> itemShards; // a shard index of each item
+      itemShards.reserve(std::distance(first, last));
+
+      const auto shardsCount = std::size_t{ 1 } << (64 - m_shardIndexShift);
+      std::vector<std::size_t> shardItemsBegin(shardsCount + 1, 0);
+      for (auto it = first; it != last; ++it)
+      {
+         const auto shardIndex = getShardIndex(std::get<0>(*it));
+         ++shardItemsBegin[shardIndex + 1];
+         itemShards.emplace_back(shardIndex);
+      }
+
+      for (std::size_t shardIndex = 1; shardIndex < shardItemsBegin.size(); ++shardIndex)
+      {
+         shardItemsBegin[shardIndex] += shardItemsBegin[shardIndex - 1];
+      }
+
+      std::vector<ForwardIt> items(itemShards.size());
+      {
+         auto shardItemsEnd = shardItemsBegin;
+         auto itItemShard = std::begin(itemShards);
+         for (auto it = first; it != last; ++it, ++itItemShard)
+         {
+            items[shardItemsEnd[*itItemShard]++] = it;
+         }
+      }
+
+      std::vector<std::tuple<KeyDataManagerPtr, std::vector<ForwardIt>>> groups; // a data manager and its items
+      std::vector<std::size_t> itemGroups(items.size(), noGroup); // a group index of each bucketed item
+
+      std::unordered_map<const KeyDataManager*, std::size_t> groupIndexes;
+
+      for (std::size_t shardIndex = 0; shardIndex < shardsCount; ++shardIndex)
+      {
+         const auto itemsBegin = shardItemsBegin[shardIndex];
+         const auto itemsEnd = shardItemsBegin[shardIndex + 1];
+         if (itemsBegin == itemsEnd)
+         {
+            continue;
+         }
+
+         auto& shard = m_shards[shardIndex];
+         std::shared_lock sharedLock(shard.mutex);
+
+         for (auto itemIndex = itemsBegin; itemIndex != itemsEnd; ++itemIndex)
+         {
+            auto itDataManager = shard.dataManagers.find(std::get<0>(*items[itemIndex]));
+            if (itDataManager != std::end(shard.dataManagers))
+            {
+               itemGroups[itemIndex] = getGroupIndex(std::get<dataManager>(itDataManager->second), groups, groupIndexes);
+            }
+         }
+      }
+
+      if (isHistoryRetained(m_retention))
+      {
+         // the new keys keep their values as history too
+         for (std::size_t itemIndex = 0; itemIndex < items.size(); ++itemIndex)
+         {
+            if (itemGroups[itemIndex] == noGroup)
+            {
+               itemGroups[itemIndex] = getGroupIndex(findDataManager(std::get<0>(*items[itemIndex])), groups, groupIndexes);
+            }
+         }
+      }
+
+      // the items are grouped out of the registry lock, a key's items are in the same bucket, so they keep their order.
+      // The groups keep the items' iterators, the values are copied (or moved) only into the data managers.
+      for (std::size_t itemIndex = 0; itemIndex < items.size(); ++itemIndex)
+      {
+         if (itemGroups[itemIndex] != noGroup)
+         {
+            std::get<1>(groups[itemGroups[itemIndex]]).emplace_back(items[itemIndex]);
+         }
+      }
+
+      using ItemIt = typename std::vector<ForwardIt>::const_iterator;
+
+      std::size_t rejectedCount = 0;
+      for (const auto& [keyDataManager, groupItems] : groups)
+      {
+         rejectedCount += addValues(*keyDataManager, BatchValuesIterator<ItemIt>(std::cbegin(groupItems)), BatchValuesIterator<ItemIt>(std::cend(groupItems)));
+      }
+
+      return rejectedCount;
+   }
+
+   /// <summary>
+   /// Gets statistics of the subscribed keys and the consumers: the retained values, the subscribers,
+   /// the consumers' lags per key and their scheduling state.
+   /// A registry shard is locked (shared) only while its keys are listed, the data managers and the consumers are queried
+   /// out of the registry locks one by one, so the statistics are not an atomic snapshot.
+   /// </summary>
+   MultiQueueProcessorStats<Key, Value> GetStats() const
+   {
+      MultiQueueProcessorStats<Key, Value> stats;
+
+      std::vector<KeyDataManagerPtr> keyDataManagers;
+
+      const auto shardsCount = std::size_t{ 1 } << (64 - m_shardIndexShift);
+      for (std::size_t shardIndex = 0; shardIndex < shardsCount; ++shardIndex)
+      {
+         auto& shard = m_shards[shardIndex];
+         std::shared_lock sharedLock(shard.mutex);
+
+         for (const auto& [key, keyRecord] : shard.dataManagers)
+         {
+            stats.keys.emplace_back(KeyStats<Key>{ key, std::get<subscribersToKey>(keyRecord).size(), {} });
+            keyDataManagers.emplace_back(std::get<dataManager>(keyRecord));
+         }
+      }
+
+      for (std::size_t i = 0; i < keyDataManagers.size(); ++i)
+      {
+         stats.keys[i].storage = keyDataManagers[i]->GetStats();
+      }
+
+      std::vector<ConsumerProcessorPtr<Key, Value, TPool, Hash, TInstrumentation, TTracer>> consumerProcessors;
+
+      {
+         std::scoped_lock consumersLock(m_consumerProcessorsMutex);
+
+         consumerProcessors.reserve(m_consumerProcessors.size());
+         for (const auto& [consumer, consumerProcessor] : m_consumerProcessors)
+         {
+            consumerProcessors.emplace_back(consumerProcessor);
+         }
+      }
+
+      stats.consumers.reserve(consumerProcessors.size());
+      for (const auto& consumerProcessor : consumerProcessors)
+      {
+         stats.consumers.emplace_back(consumerProcessor->GetStats());
+      }
+
+      return stats;
+   }
+
+   /// <summary>
+   /// Gets the latency histograms of the current subscriptions, LatencyInstrumentation is required.
+   /// The histograms of a consumer are dropped when it unsubscribes from all its keys.
+   /// </summary>
+   /// <param name="isResetRequested">Whether the histograms are reset after the snapshot, so the next one covers the next interval only</param>
+   LatencySnapshot<Key, Value, Hash> GetLatencySnapshot(bool isResetRequested = false)
+   {
+      static_assert(TInstrumentation::isEnabled, "The latency histograms require LatencyInstrumentation");
+
+      std::vector<ConsumerProcessorPtr<Key, Value, TPool, Hash, TInstrumentation, TTracer>> consumerProcessors;
+
+      {
+         std::scoped_lock consumersLock(m_consumerProcessorsMutex);
+
+         consumerProcessors.reserve(m_consumerProcessors.size());
+         for (const auto& [consumer, consumerProcessor] : m_consumerProcessors)
+         {
+            consumerProcessors.emplace_back(consumerProcessor);
+         }
+      }
+
+      LatencySnapshot<Key, Value, Hash> snapshot;
+      for (const auto& consumerProcessor : consumerProcessors)
+      {
+         auto& consumerHistograms = snapshot.consumers[consumerProcessor->GetConsumer()];
+         consumerProcessor->VisitLatencyHistograms([&snapshot, &consumerHistograms](const Key& key, const LatencyHistograms& histograms)
+            {
+               snapshot.keys[key].Merge(histograms);
+               consumerHistograms.Merge(histograms);
+            }, isResetRequested);
+      }
+
+      return snapshot;
+   }
+
+private:
+   /// <summary>
+   /// Makes a value for a data manager, it is stamped with the current time in case of LatencyInstrumentation
    /// </summary>
    template <typename TValue>
-   void Enqueue(const Key& key, TValue&& value)
+   static decltype(auto) makeStoredValue(TValue&& value)
+   {
+      if constexpr (TInstrumentation::isEnabled)
+      {
+         return StoredValue{ Value(std::forward<TValue>(value)), std::chrono::steady_clock::now() };
+      }
+      else
+      {
+         return std::forward<TValue>(value);
+      }
+   }
+
+   template <typename ForwardIt>
+   static std::size_t addValues(KeyDataManager& keyDataManager, ForwardIt first, ForwardIt last)
+   {
+      if constexpr (TInstrumentation::isEnabled)
+      {
+         const auto enqueueTime = std::chrono::steady_clock::now();
+
+         std::vector<StoredValue> values;
+         values.reserve(std::distance(first, last));
+         for (; first != last; ++first)
+         {
+            values.emplace_back(StoredValue{ Value(*first), enqueueTime });
+         }
+
+         return keyDataManager.AddValues(std::make_move_iterator(std::begin(values)), std::make_move_iterator(std::end(values)));
+      }
+      else
+      {
+         return keyDataManager.AddValues(first, last);
+      }
+   }
+
+   /// <summary>
+   /// Gets the index of a data manager's values group of EnqueueBatch, the group is added in case it is new
+   /// </summary>
+   template <typename ForwardIt>
+   static std::size_t getGroupIndex(const KeyDataManagerPtr& keyDataManager, std::vector<std::tuple<KeyDataManagerPtr, std::vector<ForwardIt>>>& groups,
+                                    std::unordered_map<const KeyDataManager*, std::size_t>& groupIndexes)
+   {
+      auto [itGroupIndex, isInserted] = groupIndexes.try_emplace(keyDataManager.get(), groups.size());
+      if (isInserted)
+      {
+         groups.emplace_back(keyDataManager, std::vector<ForwardIt>{});
+      }
+
+      return itGroupIndex->second;
+   }
+
+   /// <summary>
+   /// Creates a consumer's value source, only DataManager can start it from the key's history
+   /// </summary>
+   static IValueSourcePtr<Key, StoredValue> createValueSource(KeyDataManager& keyDataManager, IValueSourceConsumerPtr<Key, StoredValue> consumer,
+                                                              const SubscriptionSettings& subscription)
+   {
+      if constexpr (TUNING == ETuning::size)
+      {
+         return keyDataManager.CreateValueSource(std::move(consumer), subscription);
+      }
+      else
+      {
+         return keyDataManager.CreateValueSource(std::move(consumer));
+      }
+   }
+
+   /// <summary>
+   /// Whether a key's data manager keeps a history, so it is kept registered without subscribers
+   /// </summary>
+   static bool isHistoryRetained(const KeyDataManager& keyDataManager)
+   {
+      if constexpr (TUNING == ETuning::size)
+      {
+         return keyDataManager.IsHistoryRetained();
+      }
+      else
+      {
+         return false;
+      }
+   }
+
+   static bool isHistoryRetained(const RetentionSettings& retention)
+   {
+      return TUNING == ETuning::size && retention.HasHistory();
+   }
+
+   /// <summary>
+   /// Gets a key's trace events id, the key's hash is calculated only in case the tracing is enabled
+   /// </summary>
+   static std::uint64_t traceId(const Key& key)
+   {
+      if constexpr (TTracer::isEnabled)
+      {
+         return static_cast<std::uint64_t>(Hash{}(key));
+      }
+      else
+      {
+         return 0;
+      }
+   }
+
+   /// <summary>
+   /// Finds a key's data manager, it is created for a new key in case the processor's retention keeps a history
+   /// </summary>
+   KeyDataManagerPtr findDataManager(const Key& key)
    {
-      KeyDataManagerPtr keyDataManager;
+      auto& shard = getShard(key);
+
+      {
+         std::shared_lock sharedLock(shard.mutex);
 
+         auto itDataManager = shard.dataManagers.find(key);
+         if (itDataManager != std::end(shard.dataManagers))
+         {
+            return std::get<dataManager>(itDataManager->second);
+         }
+      }
+
+      if (!isHistoryRetained(m_retention))
       {
-         std::shared_lock sharedLock(m_mutex);
+         return nullptr;
+      }
 
-         auto itDataManager = m_dataManagers.find(key);
-         if (itDataManager == std::end(m_dataManagers))
+      std::scoped_lock lock(shard.mutex);
+
+      auto itDataManager = shard.dataManagers.find(key);
+      if (itDataManager == std::end(shard.dataManagers))
+      {
+         // the key's publishers and subscribers must share the same data manager
+         auto keyDataManager = findPublishedDataManager(shard, key);
+         if (!keyDataManager)
          {
-            return;
+            keyDataManager = std::make_shared<KeyDataManager>(key, m_retention);
          }
 
-         keyDataManager = std::get<dataManager>(itDataManager->second);
+         itDataManager = shard.dataManagers.try_emplace(key, std::move(keyDataManager), std::vector<IConsumerPtr<Key, Value>>{}).first;
+      }
+
+      return std::get<dataManager>(itDataManager->second);
+   }
+
+   /// <summary>
+   /// Finds a data manager which is pinned by the key's publishers. Must be called under the shard lock.
+   /// </summary>
+   static KeyDataManagerPtr findPublishedDataManager(KeyRegistryShard& shard, const Key& key)
+   {
+      auto itPublished = shard.publishedDataManagers.find(key);
+      if (itPublished == std::end(shard.publishedDataManagers))
+      {
+         return nullptr;
+      }
+
+      auto keyDataManager = itPublished->second.lock();
+      if (!keyDataManager)
+      {
+         shard.publishedDataManagers.erase(itPublished);
+      }
+
+      return keyDataManager;
+   }
+
+   /// <summary>
+   /// Calculates the shift which turns a mixed 64-bit hash into a shard index (the top bits are taken)
+   /// </summary>
+   static unsigned getShardIndexShift(std::size_t shardsCount)
+   {
+      unsigned bits = 0;
+      while (bits < 16 && (std::size_t{ 1 } << bits) < shardsCount)
+      {
+         ++bits;
+      }
+
+      return 64 - bits;
+   }
+
+   std::size_t getShardIndex(const Key& key) const
+   {
+      if (m_shardIndexShift == 64)
+      {
+         return 0;
       }
 
-      keyDataManager->AddValue(std::forward<TValue>(value));
+      // Fibonacci hashing mixes the hash, so a shard's keys are still spread over all buckets of its map
+      const auto hash = static_cast<std::uint64_t>(Hash{}(key));
+      return static_cast<std::size_t>((hash * 0x9E3779B97F4A7C15ull) >> m_shardIndexShift);
+   }
+
+   KeyRegistryShard& getShard(const Key& key)
+   {
+      return m_shards[getShardIndex(key)];
    }
 
 private:
-   std::shared_mutex m_mutex; // guards m_consumerProcessors and m_dataManagers
-   std::unordered_map<IConsumerPtr<Key, Value>, ConsumerProcessorPtr<Key, Value, TPool, Hash>> m_consumerProcessors;
-   std::unordered_map<Key, std::tuple<KeyDataManagerPtr, std::vector<IConsumerPtr<Key, Value>>>, Hash> m_dataManagers;
+   const unsigned m_shardIndexShift;
+   const std::unique_ptr<KeyRegistryShard[]> m_shards;
+   const RetentionSettings m_retention; // the default keys' values retention
+   mutable std::mutex m_consumerProcessorsMutex; // guards m_consumerProcessors, no shard lock is taken under it
+   std::unordered_map<IConsumerPtr<Key, Value>, ConsumerProcessorPtr<Key, Value, TPool, Hash, TInstrumentation, TTracer>> m_consumerProcessors;
+   const ConsumerProcessorSettings m_consumerProcessorSettings;
    const std::shared_ptr<TPool> m_threadPool; // a thread pool that is used for "consumers calls" tasks execution
 };
 }
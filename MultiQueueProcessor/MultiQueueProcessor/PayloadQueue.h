@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include <assert.h>
+
+#include "SpscQueue.h"
+#include "ValuesView.h"
+
+namespace MQP
+{
+
+namespace details
+{
+
+/// <summary>
+/// A locator's queue of values, each value is a copy of its own (see PayloadCopied).
+/// The values are appended by a producer at a time and read by a single consumer without locks (see SpscQueue).
+/// </summary>
+template <typename Value>
+class CopiedPayloadQueue
+{
+public:
+   bool empty() const noexcept
+   {
+      return m_values.empty();
+   }
+
+   const Value& front() const
+   {
+      return m_values.Front();
+   }
+
+   /// <summary>
+   /// Gets the contiguous values from the front, they are the values of the queue's block
+   /// </summary>
+   ValuesView<Value> GetRun(std::size_t maxCount) const
+   {
+      assert(maxCount != 0);
+      return ValuesView<Value>(&m_values.Front(), m_values.GetFrontRunSize(maxCount));
+   }
+
+   template <typename TValue>
+   void Push(TValue&& value)
+   {
+      m_values.Push(std::forward<TValue>(value));
+   }
+
+   void Pop(std::size_t count)
+   {
+      m_values.Pop(count);
+   }
+
+   std::uint64_t GetPushedCount() const noexcept
+   {
+      return m_values.GetPushedCount();
+   }
+
+   std::uint64_t GetPoppedCount() const noexcept
+   {
+      return m_values.GetPoppedCount();
+   }
+
+private:
+   SpscQueue<Value> m_values;
+};
+
+/// <summary>
+/// An immutable block of values which is allocated once per adding and shared by the locators' queues (see SharedPayloadQueue).
+/// The block is freed by the last reference's release. A producer grants the references to the queues in advance,
+/// so a queue takes its reference without an atomic operation, the unused grants are returned by a single release.
+/// </summary>
+template <typename Value>
+class alignas(std::max(alignof(Value), alignof(std::atomic_uint32_t))) SharedPayload
+{
+public:
+   /// <summary>
+   /// Creates a block of the values [first, first + count)
+   /// </summary>
+   /// <param name="referencesCount">The initial count of references, the creator's one and the granted ones.</param>
+   template <typename InputIt>
+   static SharedPayload* Create(InputIt first, std::size_t count, std::uint32_t referencesCount)
+   {
+      auto* payload = new (::operator new(getAllocationSize(count), std::align_val_t{ alignof(SharedPayload) })) SharedPayload(referencesCount);
+
+      try
+      {
+         for (; payload->m_count != count; ++payload->m_count, ++first)
+         {
+            new (payload->getValues() + payload->m_count) Value(*first);
+         }
+      }
+      catch (...)
+      {
+         payload->destroy();
+         throw;
+      }
+
+      return payload;
+   }
+
+   SharedPayload(const SharedPayload&) = delete;
+   SharedPayload& operator=(const SharedPayload&) = delete;
+
+   const Value* Values() const noexcept
+   {
+      return const_cast<SharedPayload*>(this)->getValues();
+   }
+
+   std::size_t Size() const noexcept
+   {
+      return m_count;
+   }
+
+   void AddReference() noexcept
+   {
+      m_referencesCount.fetch_add(1, std::memory_order_relaxed);
+   }
+
+   void Release(std::uint32_t count = 1) noexcept
+   {
+      if (m_referencesCount.fetch_sub(count, std::memory_order_acq_rel) == count)
+      {
+         destroy();
+      }
+   }
+
+private:
+   explicit SharedPayload(std::uint32_t referencesCount) noexcept : m_referencesCount(referencesCount)
+   {}
+
+   ~SharedPayload() = default;
+
+   static constexpr std::size_t getValuesOffset() noexcept
+   {
+      return (sizeof(SharedPayload) + alignof(Value) - 1) / alignof(Value) * alignof(Value);
+   }
+
+   static std::size_t getAllocationSize(std::size_t count) noexcept
+   {
+      return getValuesOffset() + count * sizeof(Value);
+   }
+
+   Value* getValues() noexcept
+   {
+      return reinterpret_cast<Value*>(reinterpret_cast<std::byte*>(this) + getValuesOffset());
+   }
+
+   void destroy() noexcept
+   {
+      auto* values = getValues();
+      for (std::size_t i = 0; i != m_count; ++i)
+      {
+         values[i].~Value();
+      }
+
+      this->~SharedPayload();
+      ::operator delete(static_cast<void*>(this), std::align_val_t{ alignof(SharedPayload) });
+   }
+
+private:
+   std::atomic_uint32_t m_referencesCount;
+   std::size_t m_count = 0; // count of the constructed values
+};
+
+/// <summary>
+/// A locator's queue of values which are kept by shared payloads (see PayloadShared).
+/// The queue keeps runs of a payload's neighbouring values, a run holds a reference to its payload,
+/// so the values of one adding cost a single reference per locator and they are read as a contiguous run.
+/// The runs are appended by a producer at a time and read by a single consumer without locks (see SpscQueue).
+/// </summary>
+template <typename Value>
+class SharedPayloadQueue
+{
+   struct Run
+   {
+      SharedPayload<Value>* payload;
+      const Value* first;
+      std::size_t count;
+   };
+
+public:
+   SharedPayloadQueue() = default;
+
+   SharedPayloadQueue(const SharedPayloadQueue&) = delete;
+   SharedPayloadQueue& operator=(const SharedPayloadQueue&) = delete;
+
+   ~SharedPayloadQueue()
+   {
+      while (!m_runs.empty())
+      {
+         m_runs.Front().payload->Release();
+         m_runs.Pop(1);
+      }
+   }
+
+   bool empty() const noexcept
+   {
+      return m_runs.empty();
+   }
+
+   const Value& front() const
+   {
+      return m_runs.Front().first[m_frontOffset];
+   }
+
+   /// <summary>
+   /// Gets the contiguous values from the front, they are the values of the first run
+   /// </summary>
+   ValuesView<Value> GetRun(std::size_t maxCount) const
+   {
+      assert(maxCount != 0);
+
+      const auto& run = m_runs.Front();
+      return ValuesView<Value>(run.first + m_frontOffset, std::min(maxCount, run.count - m_frontOffset));
+   }
+
+   /// <summary>
+   /// Appends a run of a payload's values [index, index + count).
+   /// The run takes one of the granted references, or a new one in case the grants are over.
+   /// </summary>
+   void Push(SharedPayload<Value>& payload, std::size_t index, std::size_t count, std::uint32_t& grantedReferencesCount)
+   {
+      assert(count != 0 && index + count <= payload.Size());
+
+      if (grantedReferencesCount != 0)
+      {
+         --grantedReferencesCount;
+      }
+      else
+      {
+         payload.AddReference();
+      }
+
+      m_runs.Push(Run{ &payload, payload.Values() + index, count });
+      m_pushedCount.store(m_pushedCount.load(std::memory_order_relaxed) + count, std::memory_order_release);
+   }
+
+   void Pop(std::size_t count)
+   {
+      m_poppedCountLocal += count;
+
+      while (count != 0)
+      {
+         const auto& run = m_runs.Front();
+         const auto left = run.count - m_frontOffset;
+         if (count < left)
+         {
+            m_frontOffset += count;
+            break;
+         }
+
+         count -= left;
+         run.payload->Release();
+         m_runs.Pop(1);
+         m_frontOffset = 0;
+      }
+
+      m_poppedCount.store(m_poppedCountLocal, std::memory_order_release);
+   }
+
+   /// <summary>
+   /// Gets count of the values of all appended runs
+   /// </summary>
+   std::uint64_t GetPushedCount() const noexcept
+   {
+      return m_pushedCount.load(std::memory_order_acquire);
+   }
+
+   std::uint64_t GetPoppedCount() const noexcept
+   {
+      return m_poppedCount.load(std::memory_order_acquire);
+   }
+
+private:
+   SpscQueue<Run> m_runs;
+   std::atomic_uint64_t m_pushedCount = 0; // the producer's side
+   // the consumer's side
+   std::size_t m_frontOffset = 0; // count of the first run's values which are popped
+   std::uint64_t m_poppedCountLocal = 0;
+   alignas(64) std::atomic_uint64_t m_poppedCount = 0;
+};
+
+}
+
+}
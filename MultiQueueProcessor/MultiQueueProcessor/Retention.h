@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+#include "Stats.h"
+
+namespace MQP
+{
+
+/// <summary>
+/// What a data manager does with a new value when a key's consumer has the capacity of values retained already
+/// </summary>
+enum class EOverflowPolicy
+{
+   block,      // the producer waits till the consumer frees room (a consumer must not enqueue values for its own keys)
+   dropOldest, // the oldest value of the lagging consumer which is not being consumed is dropped, DataManager and DataManagerFavorSpeed
+               // erase the values after the consumed one lazily, so they drop the new value once a stalled consumer keeps twice the capacity
+               // (DataManagerFavorLatency drops the new value instead)
+   dropNewest, // the new value is dropped for the lagging consumer
+   fail        // the new value is rejected and Enqueue reports it
+};
+
+/// <summary>
+/// A key's values retention settings
+/// </summary>
+struct RetentionSettings
+{
+   // max count of values retained for a key's consumer: the values of the slowest consumer for DataManager,
+   // the values of each consumer for DataManagerFavorSpeed, not more than the ring capacity for DataManagerFavorLatency
+   std::size_t capacity = std::numeric_limits<std::size_t>::max();
+   // the policy which is applied when the capacity is reached
+   EOverflowPolicy overflowPolicy = EOverflowPolicy::block;
+   // count of the latest values which are kept for late subscribers regardless of the consumers, zero means no count limit
+   // (the history is kept by DataManager only, the key is kept while it has no subscribers, see SubscriptionSettings)
+   std::size_t historyCount = 0;
+   // max age of the values which are kept for late subscribers, zero means no age limit, the expired values are erased
+   // lazily on the key's next adding, consuming or subscription. The count and the age limits are combined in case both are set.
+   std::chrono::nanoseconds historyDuration = std::chrono::nanoseconds::zero();
+   // Note: a history set for the whole processor (see MultiQueueProcessorSettings::retention) registers every enqueued key
+   // and keeps it for the processor's lifetime, even after its history expires, so the memory grows with the count
+   // of distinct keys. Such a history suits a bounded key set, for an unbounded one only the subscriptions of the keys which need a history
+   // should pass it (see MultiQueueProcessor::Subscribe), a key with a history is kept after its last unsubscription too.
+
+   bool IsBounded() const
+   {
+      return capacity != std::numeric_limits<std::size_t>::max();
+   }
+
+   bool HasHistory() const
+   {
+      return historyCount != 0 || historyDuration != std::chrono::nanoseconds::zero();
+   }
+};
+
+/// <summary>
+/// Where a new subscription starts reading the key's values
+/// </summary>
+enum class EStartPosition
+{
+   now,            // the values enqueued after the subscription
+   oldestRetained, // the oldest value of the key's history (see RetentionSettings::historyCount)
+   lastN           // the last SubscriptionSettings::replayCount values of the key's history
+};
+
+/// <summary>
+/// A subscription's settings
+/// </summary>
+struct SubscriptionSettings
+{
+   EStartPosition startPosition = EStartPosition::now;
+   // count of values which are replayed with EStartPosition::lastN (not more than the history keeps)
+   std::size_t replayCount = 0;
+};
+
+namespace details
+{
+
+/// <summary>
+/// A data manager's overflow policy counters, they are updated by producers and read by statistics
+/// </summary>
+struct OverflowCounters
+{
+   std::atomic_uint64_t blockedCount = 0;
+   std::atomic_uint64_t droppedOldestCount = 0;
+   std::atomic_uint64_t droppedNewestCount = 0;
+   std::atomic_uint64_t rejectedCount = 0;
+
+   static void Increment(std::atomic_uint64_t& counter, std::uint64_t count = 1)
+   {
+      counter.fetch_add(count, std::memory_order_relaxed);
+   }
+
+   OverflowStats Get() const
+   {
+      return { blockedCount.load(std::memory_order_relaxed), droppedOldestCount.load(std::memory_order_relaxed),
+               droppedNewestCount.load(std::memory_order_relaxed), rejectedCount.load(std::memory_order_relaxed) };
+   }
+};
+
+}
+
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <assert.h>
+
+namespace MQP
+{
+
+/// <summary>
+/// A FIFO container which keeps elements in fixed-size segments (blocks) linked one after another.
+/// Elements of a segment are laid out contiguously, so sequential reading touches a minimal count of cache lines,
+/// and a value enqueuing needs no allocation until the tail segment is full.
+/// Released segments are recycled through a free list, so a steady flow of values causes no allocations at all.
+/// Positions are stable: an iterator remains valid until the element it points to is erased,
+/// end() is a sentinel that is never invalidated by adding new elements (like std::list::end()).
+/// Only the subset of std::list interface which is needed by DataManager is supported:
+/// emplacing at the end, forward iteration and erasing of a leading range.
+/// </summary>
+template <typename T, std::size_t SegmentSize = 64>
+class SegmentedStorage
+{
+   static_assert(SegmentSize > 0, "A segment must be able to keep at least one element");
+
+   struct alignas(64) Segment
+   {
+      T* at(std::size_t index) noexcept
+      {
+         return std::launder(reinterpret_cast<T*>(&slots[index]));
+      }
+
+      std::aligned_storage_t<sizeof(T), alignof(T)> slots[SegmentSize];
+      std::size_t size = 0; // count of constructed elements (the first ones can be already erased, see m_headIndex)
+      Segment* next = nullptr;
+   };
+
+   template <bool IS_CONST>
+   class Iterator
+   {
+      friend SegmentedStorage;
+   public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = T;
+      using difference_type = std::ptrdiff_t;
+      using pointer = std::conditional_t<IS_CONST, const T*, T*>;
+      using reference = std::conditional_t<IS_CONST, const T&, T&>;
+
+      Iterator() = default;
+
+      template <bool OTHER_CONST, typename = std::enable_if_t<IS_CONST && !OTHER_CONST>>
+      Iterator(const Iterator<OTHER_CONST>& rhs) noexcept : m_segment(rhs.m_segment), m_index(rhs.m_index)
+      {}
+
+      reference operator*() const noexcept
+      {
+         assert(m_segment != nullptr);
+         return *m_segment->at(m_index);
+      }
+
+      pointer operator->() const noexcept
+      {
+         return &**this;
+      }
+
+      Iterator& operator++() noexcept
+      {
+         assert(m_segment != nullptr);
+         if (++m_index == m_segment->size)
+         {
+            // the next segment (if any) is never empty, otherwise this is the last element
+            m_segment = m_segment->next;
+            m_index = 0;
+         }
+
+         return *this;
+      }
+
+      Iterator operator++(int) noexcept
+      {
+         auto prev = *this;
+         ++*this;
+         return prev;
+      }
+
+      template <bool OTHER_CONST>
+      bool operator==(const Iterator<OTHER_CONST>& rhs) const noexcept
+      {
+         return m_segment == rhs.m_segment && m_index == rhs.m_index;
+      }
+
+      template <bool OTHER_CONST>
+      bool operator!=(const Iterator<OTHER_CONST>& rhs) const noexcept
+      {
+         return !(*this == rhs);
+      }
+
+   private:
+      template <bool> friend class Iterator;
+
+      Iterator(Segment* segment, std::size_t index) noexcept : m_segment(segment), m_index(index)
+      {}
+
+      Segment* m_segment = nullptr; // nullptr means end()
+      std::size_t m_index = 0;
+   };
+
+public:
+   using value_type = T;
+   using size_type = std::size_t;
+   using reference = T&;
+   using const_reference = const T&;
+   using iterator = Iterator<false>;
+   using const_iterator = Iterator<true>;
+
+   SegmentedStorage() = default;
+
+   ~SegmentedStorage()
+   {
+      erase(begin(), end());
+
+      while (m_freeSegments != nullptr)
+      {
+         delete std::exchange(m_freeSegments, m_freeSegments->next);
+      }
+   }
+
+   SegmentedStorage(const SegmentedStorage&) = delete;
+   SegmentedStorage& operator=(const SegmentedStorage&) = delete;
+   SegmentedStorage(SegmentedStorage&&) = delete;
+   SegmentedStorage& operator=(SegmentedStorage&&) = delete;
+
+   iterator begin() noexcept { return { m_head, m_headIndex }; }
+   const_iterator begin() const noexcept { return { m_head, m_headIndex }; }
+   iterator end() noexcept { return {}; }
+   const_iterator end() const noexcept { return {}; }
+
+   bool empty() const noexcept { return m_size == 0; }
+   size_type size() const noexcept { return m_size; }
+
+   /// <summary>
+   /// Gets the memory of all allocated segments, including the recycled ones
+   /// </summary>
+   std::size_t allocated_bytes() const noexcept { return m_allocatedSegmentsCount * sizeof(Segment); }
+
+   /// <summary>
+   /// Constructs a new element at the end. Only emplacing at the end (pos == end()) is supported.
+   /// </summary>
+   /// <returns>An iterator to the emplaced element</returns>
+   template <typename... Args>
+   iterator emplace(const_iterator pos, Args&&... args)
+   {
+      assert(pos == end());
+      (void)pos;
+
+      if (m_tail == nullptr || m_tail->size == SegmentSize)
+      {
+         Segment* segment = acquireSegment();
+         if (m_tail == nullptr)
+         {
+            m_head = m_tail = segment;
+            m_headIndex = 0;
+         }
+         else
+         {
+            m_tail->next = segment;
+            m_tail = segment;
+         }
+      }
+
+      new (&m_tail->slots[m_tail->size]) T(std::forward<Args>(args)...);
+      ++m_size;
+
+      return { m_tail, m_tail->size++ };
+   }
+
+   /// <summary>
+   /// Erases elements [first, last). Only a leading range (first == begin()) is supported.
+   /// </summary>
+   iterator erase(const_iterator first, const_iterator last)
+   {
+      assert(first == begin());
+      (void)first;
+
+      while (m_head != nullptr && !(m_head == last.m_segment && m_headIndex == last.m_index))
+      {
+         m_head->at(m_headIndex)->~T();
+         --m_size;
+
+         if (++m_headIndex == m_head->size)
+         {
+            releaseSegment(std::exchange(m_head, m_head->next));
+            m_headIndex = 0;
+
+            if (m_head == nullptr)
+            {
+               m_tail = nullptr;
+            }
+         }
+      }
+
+      return { m_head, m_headIndex };
+   }
+
+private:
+   Segment* acquireSegment()
+   {
+      if (m_freeSegments == nullptr)
+      {
+         auto* segment = new Segment;
+         ++m_allocatedSegmentsCount;
+         return segment;
+      }
+
+      --m_freeSegmentsCount;
+      Segment* segment = std::exchange(m_freeSegments, m_freeSegments->next);
+      segment->next = nullptr;
+      return segment;
+   }
+
+   void releaseSegment(Segment* segment) noexcept
+   {
+      if (m_freeSegmentsCount == maxFreeSegments)
+      {
+         delete segment;
+         --m_allocatedSegmentsCount;
+         return;
+      }
+
+      segment->size = 0;
+      segment->next = m_freeSegments;
+      m_freeSegments = segment;
+      ++m_freeSegmentsCount;
+   }
+
+private:
+   // the free list is bounded, otherwise a single burst would pin its memory forever
+   static constexpr std::size_t maxFreeSegments = 4;
+
+   Segment* m_head = nullptr;
+   std::size_t m_headIndex = 0; // index of the first not erased element in m_head
+   Segment* m_tail = nullptr;
+   std::size_t m_size = 0;
+   Segment* m_freeSegments = nullptr;
+   std::size_t m_freeSegmentsCount = 0;
+   std::size_t m_allocatedSegmentsCount = 0;
+};
+
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+#include <assert.h>
+
+namespace MQP
+{
+
+namespace details
+{
+
+/// <summary>
+/// An unbounded single-producer single-consumer queue of elements kept in linked fixed-size blocks.
+/// The producer appends to the tail block and links a new one when it is full, the consumer frees a block once it has passed it.
+/// Neither side locks or makes an atomic read-modify-write: each side publishes its own count by a release store
+/// and reads the other's one by an acquire load. The elements of a block are contiguous, so the consumer can read them as a run.
+/// Several producers must be serialized by the caller, the counts can be read by any thread.
+/// </summary>
+template <typename T>
+class SpscQueue
+{
+   static constexpr std::size_t blockSize = std::max<std::size_t>(1024 / sizeof(T), 16);
+
+   struct Block
+   {
+      std::atomic<Block*> next = nullptr;
+      alignas(T) std::byte storage[blockSize * sizeof(T)];
+
+      T* GetElements() noexcept
+      {
+         return reinterpret_cast<T*>(storage);
+      }
+   };
+
+public:
+   SpscQueue() : m_head(new Block), m_tail(m_head)
+   {}
+
+   SpscQueue(const SpscQueue&) = delete;
+   SpscQueue& operator=(const SpscQueue&) = delete;
+
+   ~SpscQueue()
+   {
+      Pop(static_cast<std::size_t>(m_pushedCount.load(std::memory_order_acquire) - m_poppedCountLocal));
+
+      while (m_head)
+      {
+         delete std::exchange(m_head, m_head->next.load(std::memory_order_acquire));
+      }
+   }
+
+   /// <summary>
+   /// Appends an element (the producer's side)
+   /// </summary>
+   template <typename... TArgs>
+   void Push(TArgs&&... args)
+   {
+      if (m_tailIndex == blockSize)
+      {
+         auto* block = new Block;
+         m_tail->next.store(block, std::memory_order_release);
+         m_tail = block;
+         m_tailIndex = 0;
+      }
+
+      new (m_tail->GetElements() + m_tailIndex) T(std::forward<TArgs>(args)...);
+      ++m_tailIndex;
+
+      m_pushedCount.store(m_pushedCount.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+   }
+
+   /// <summary>
+   /// Whether there is no element to pop, it can be called by any thread
+   /// </summary>
+   bool empty() const noexcept
+   {
+      return m_pushedCount.load(std::memory_order_acquire) == m_poppedCount.load(std::memory_order_relaxed);
+   }
+
+   /// <summary>
+   /// Gets the first element, the queue must not be empty (the consumer's side)
+   /// </summary>
+   const T& Front() const
+   {
+      assert(!empty());
+      return *getHeadElement();
+   }
+
+   /// <summary>
+   /// Gets count of contiguous elements from the first one, not more than maxCount (the consumer's side)
+   /// </summary>
+   std::size_t GetFrontRunSize(std::size_t maxCount) const
+   {
+      assert(!empty());
+      getHeadElement();
+
+      const auto available = static_cast<std::size_t>(m_pushedCount.load(std::memory_order_acquire) - m_poppedCountLocal);
+      return std::min({ maxCount, available, blockSize - m_headIndex });
+   }
+
+   /// <summary>
+   /// Pops count elements, a passed block is freed (the consumer's side)
+   /// </summary>
+   void Pop(std::size_t count)
+   {
+      for (std::size_t i = 0; i != count; ++i)
+      {
+         getHeadElement()->~T();
+         ++m_headIndex;
+      }
+
+      m_poppedCountLocal += count;
+      m_poppedCount.store(m_poppedCountLocal, std::memory_order_release);
+   }
+
+   std::uint64_t GetPushedCount() const noexcept
+   {
+      return m_pushedCount.load(std::memory_order_acquire);
+   }
+
+   std::uint64_t GetPoppedCount() const noexcept
+   {
+      return m_poppedCount.load(std::memory_order_acquire);
+   }
+
+private:
+   /// <summary>
+   /// Gets the head element, the head block is freed in case it has been passed. An element must be available.
+   /// </summary>
+   T* getHeadElement() const
+   {
+      if (m_headIndex == blockSize)
+      {
+         auto* next = m_head->next.load(std::memory_order_acquire);
+         assert(next);
+         delete std::exchange(m_head, next);
+         m_headIndex = 0;
+      }
+
+      return m_head->GetElements() + m_headIndex;
+   }
+
+private:
+   // the consumer's side
+   mutable Block* m_head;
+   mutable std::size_t m_headIndex = 0;
+   std::uint64_t m_poppedCountLocal = 0;
+   alignas(64) std::atomic_uint64_t m_poppedCount = 0;
+
+   // the producer's side
+   alignas(64) Block* m_tail;
+   std::size_t m_tailIndex = 0;
+   std::atomic_uint64_t m_pushedCount = 0;
+};
+
+}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+#include "IConsumer.h"
+
+namespace MQP
+{
+
+/// <summary>
+/// A key's overflow policy statistics (see RetentionSettings), a value dropped per consumer is counted per consumer
+/// </summary>
+struct OverflowStats
+{
+   // count of producer waits for room (EOverflowPolicy::block)
+   std::uint64_t blockedCount = 0;
+   // count of the oldest values dropped for lagging consumers (EOverflowPolicy::dropOldest)
+   std::uint64_t droppedOldestCount = 0;
+   // count of new values dropped for lagging consumers (EOverflowPolicy::dropNewest, or dropOldest while the oldest value is being consumed)
+   std::uint64_t droppedNewestCount = 0;
+   // count of rejected values (EOverflowPolicy::fail)
+   std::uint64_t rejectedCount = 0;
+};
+
+/// <summary>
+/// A data manager's values storage statistics
+/// </summary>
+struct DataManagerStats
+{
+   // count of values kept for the key's consumers (a value copied per consumer is counted per copy)
+   std::size_t retainedValuesCount = 0;
+   // memory kept by the values storage (the value's own heap memory, e.g. a string's buffer, is not counted)
+   std::size_t retainedBytes = 0;
+   // how often the key's overflow policy has been applied
+   OverflowStats overflow;
+   // count of values overwritten by newer ones before consuming, per consumer (ETuning::conflate)
+   std::uint64_t conflatedCount = 0;
+};
+
+/// <summary>
+/// A key's statistics
+/// </summary>
+template <typename Key>
+struct KeyStats
+{
+   Key key;
+   std::size_t subscribersCount = 0;
+   DataManagerStats storage;
+};
+
+/// <summary>
+/// A consumer's statistics (see ConsumerProcessor)
+/// </summary>
+template <typename Key, typename Value>
+struct ConsumerStats
+{
+   IConsumerPtr<Key, Value> consumer;
+   // whether a consumer's task is scheduled or running
+   bool isProcessing = false;
+   // count of value sources which wait for their turn in the processing order
+   std::size_t pendingSourcesCount = 0;
+   // the consumer's keys with count of values which are not consumed yet (the lag behind the key's tail)
+   std::vector<std::tuple<Key, std::size_t>> lags;
+};
+
+/// <summary>
+/// MultiQueueProcessor's statistics (see MultiQueueProcessor::GetStats)
+/// </summary>
+template <typename Key, typename Value>
+struct MultiQueueProcessorStats
+{
+   // the subscribed keys and the ones which keep a history without subscribers (see RetentionSettings::historyCount)
+   std::vector<KeyStats<Key>> keys;
+   std::vector<ConsumerStats<Key, Value>> consumers;
+};
+
+}
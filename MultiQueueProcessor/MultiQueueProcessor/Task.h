@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <assert.h>
+
+namespace MQP
+{
+
+/// <summary>
+/// A move-only type erased void() callable.
+/// A small callable (up to Task::inlineSize bytes, e.g. a couple of smart pointers) is kept in the task's inline buffer,
+/// so creating, moving and invoking such a task costs no heap allocation. A bigger callable is kept on the heap.
+/// </summary>
+class Task
+{
+public:
+   static constexpr std::size_t inlineSize = 48;
+
+   Task() noexcept = default;
+
+   template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+   Task(F&& function)
+   {
+      using Function = std::decay_t<F>;
+
+      if constexpr (isInline<Function>())
+      {
+         ::new (static_cast<void*>(&m_storage)) Function(std::forward<F>(function));
+         m_operations = &inlineOperations<Function>;
+      }
+      else
+      {
+         ::new (static_cast<void*>(&m_storage)) Function*(new Function(std::forward<F>(function)));
+         m_operations = &heapOperations<Function>;
+      }
+   }
+
+   Task(Task&& other) noexcept
+   {
+      moveFrom(other);
+   }
+
+   Task& operator=(Task&& other) noexcept
+   {
+      if (this != &other)
+      {
+         reset();
+         moveFrom(other);
+      }
+
+      return *this;
+   }
+
+   Task(const Task&) = delete;
+   Task& operator=(const Task&) = delete;
+
+   ~Task()
+   {
+      reset();
+   }
+
+   void operator()()
+   {
+      assert(m_operations);
+      m_operations->invoke(&m_storage);
+   }
+
+   explicit operator bool() const noexcept
+   {
+      return m_operations != nullptr;
+   }
+
+private:
+   /// <summary>
+   /// Type specific operations over the stored callable
+   /// </summary>
+   struct Operations
+   {
+      void (*invoke)(void* storage);
+      void (*move)(void* from, void* to) noexcept; // move constructs "to" and destroys "from"
+      void (*destroy)(void* storage) noexcept;
+   };
+
+   using Storage = std::aligned_storage_t<inlineSize, alignof(std::max_align_t)>;
+
+   template <typename Function>
+   static constexpr bool isInline()
+   {
+      return sizeof(Function) <= sizeof(Storage) && alignof(Function) <= alignof(Storage) && std::is_nothrow_move_constructible_v<Function>;
+   }
+
+   template <typename Function>
+   static constexpr Operations inlineOperations
+   {
+      [](void* storage) { (*static_cast<Function*>(storage))(); },
+      [](void* from, void* to) noexcept
+      {
+         ::new (to) Function(std::move(*static_cast<Function*>(from)));
+         static_cast<Function*>(from)->~Function();
+      },
+      [](void* storage) noexcept { static_cast<Function*>(storage)->~Function(); }
+   };
+
+   template <typename Function>
+   static constexpr Operations heapOperations
+   {
+      [](void* storage) { (**static_cast<Function**>(storage))(); },
+      [](void* from, void* to) noexcept { ::new (to) Function*(*static_cast<Function**>(from)); },
+      [](void* storage) noexcept { delete *static_cast<Function**>(storage); }
+   };
+
+   void moveFrom(Task& other) noexcept
+   {
+      if (other.m_operations)
+      {
+         other.m_operations->move(&other.m_storage, &m_storage);
+         m_operations = std::exchange(other.m_operations, nullptr);
+      }
+   }
+
+   void reset() noexcept
+   {
+      if (m_operations)
+      {
+         std::exchange(m_operations, nullptr)->destroy(&m_storage);
+      }
+   }
+
+private:
+   Storage m_storage;
+   const Operations* m_operations = nullptr;
+};
+
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+// the header is public, so windows.h's min/max macros and rarely used APIs must not leak into the users' code,
+// the macros which are defined here are undefined right after the include
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#define MQP_WIN32_LEAN_AND_MEAN_DEFINED
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#define MQP_NOMINMAX_DEFINED
+#endif
+#include <windows.h>
+#ifdef MQP_WIN32_LEAN_AND_MEAN_DEFINED
+#undef WIN32_LEAN_AND_MEAN
+#undef MQP_WIN32_LEAN_AND_MEAN_DEFINED
+#endif
+#ifdef MQP_NOMINMAX_DEFINED
+#undef NOMINMAX
+#undef MQP_NOMINMAX_DEFINED
+#endif
+#elif defined(__linux__)
+#include <fstream>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace MQP
+{
+
+/// <summary>
+/// A group of thread pool's worker threads which are pinned to a CPU set, e.g. to the CPUs of a NUMA node
+/// </summary>
+struct ThreadPoolWorkersGroup
+{
+   // CPUs which the group's workers are pinned to, empty means no pinning
+   std::vector<unsigned> cpus;
+   // count of the group's workers, zero means a worker per CPU of the group
+   std::size_t threadsCount = 0;
+};
+
+namespace details
+{
+
+/// <summary>
+/// Pins the current thread to the CPU set
+/// </summary>
+/// <returns>Whether the thread has been pinned</returns>
+inline bool PinCurrentThread(const std::vector<unsigned>& cpus)
+{
+   if (cpus.empty())
+   {
+      return false;
+   }
+
+#if defined(_WIN32)
+   DWORD_PTR mask = 0;
+   for (const auto cpu : cpus)
+   {
+      if (cpu < sizeof(DWORD_PTR) * 8) // CPUs of the current processor group only
+      {
+         mask |= DWORD_PTR{ 1 } << cpu;
+      }
+   }
+
+   return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+   cpu_set_t cpuSet;
+   CPU_ZERO(&cpuSet);
+   for (const auto cpu : cpus)
+   {
+      if (cpu < CPU_SETSIZE)
+      {
+         CPU_SET(cpu, &cpuSet);
+      }
+   }
+
+   return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#else
+   return false;
+#endif
+}
+
+#if defined(__linux__)
+/// <summary>
+/// Parses a CPU (or NUMA node) list in the kernel's format, e.g. "0-3,8,10-11"
+/// </summary>
+inline std::vector<unsigned> ParseIdList(const std::string& idList)
+{
+   std::vector<unsigned> ids;
+
+   std::stringstream ss(idList);
+   std::string range;
+   while (std::getline(ss, range, ','))
+   {
+      if (range.empty())
+      {
+         continue;
+      }
+
+      const auto dash = range.find('-');
+      const auto first = static_cast<unsigned>(std::stoul(range.substr(0, dash)));
+      const auto last = (dash == std::string::npos) ? first : static_cast<unsigned>(std::stoul(range.substr(dash + 1)));
+      for (auto id = first; id <= last; ++id)
+      {
+         ids.emplace_back(id);
+      }
+   }
+
+   return ids;
+}
+
+inline std::string ReadFirstLine(const std::string& path)
+{
+   std::string line;
+
+   std::ifstream file(path);
+   std::getline(file, line);
+
+   return line;
+}
+#endif
+
+}
+
+/// <summary>
+/// Makes a workers group per NUMA node of the system, a worker per CPU of the node.
+/// A single group without pinning is returned if the topology is not available.
+/// </summary>
+inline std::vector<ThreadPoolWorkersGroup> MakeNumaWorkersGroups()
+{
+   std::vector<ThreadPoolWorkersGroup> groups;
+
+#if defined(_WIN32)
+   ULONG highestNode = 0;
+   if (GetNumaHighestNodeNumber(&highestNode))
+   {
+      for (UCHAR node = 0; node <= highestNode; ++node)
+      {
+         ULONGLONG mask = 0;
+         if (!GetNumaNodeProcessorMask(node, &mask) || mask == 0)
+         {
+            continue;
+         }
+
+         ThreadPoolWorkersGroup group;
+         for (unsigned cpu = 0; cpu < sizeof(mask) * 8; ++cpu)
+         {
+            if (mask & (ULONGLONG{ 1 } << cpu))
+            {
+               group.cpus.emplace_back(cpu);
+            }
+         }
+
+         groups.emplace_back(std::move(group));
+      }
+   }
+#elif defined(__linux__)
+   for (const auto node : details::ParseIdList(details::ReadFirstLine("/sys/devices/system/node/online")))
+   {
+      ThreadPoolWorkersGroup group;
+      group.cpus = details::ParseIdList(details::ReadFirstLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+      if (!group.cpus.empty())
+      {
+         groups.emplace_back(std::move(group));
+      }
+   }
+#endif
+
+   if (groups.empty())
+   {
+      groups.emplace_back();
+   }
+
+   return groups;
+}
+
+}
@@ -1,17 +1,176 @@
 #pragma once
 
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
 #include "boost/asio/thread_pool.hpp"
 #include "boost/asio/post.hpp"
 
 namespace MQP
 {
 
+namespace details
+{
+
+/// <summary>
+/// Keeps freed memory blocks of the thread pool's operations for reuse.
+/// boost::asio::thread_pool recycles an operation's memory per thread, so an operation posted by a non-pool thread
+/// and freed by a pool thread costs a heap allocation per post. The cache is shared by all threads instead.
+/// </summary>
+class OperationsMemoryCache
+{
+public:
+   static constexpr std::size_t blockSize = 128;
+
+   OperationsMemoryCache()
+   {
+      m_blocks.reserve(maxCachedBlocks);
+   }
+
+   OperationsMemoryCache(const OperationsMemoryCache&) = delete;
+   OperationsMemoryCache& operator=(const OperationsMemoryCache&) = delete;
+
+   ~OperationsMemoryCache()
+   {
+      for (void* block : m_blocks)
+      {
+         ::operator delete(block);
+      }
+   }
+
+   void* Allocate()
+   {
+      {
+         std::scoped_lock lock(m_mutex);
+         if (!m_blocks.empty())
+         {
+            void* block = m_blocks.back();
+            m_blocks.pop_back();
+            return block;
+         }
+      }
+
+      return ::operator new(blockSize);
+   }
+
+   void Deallocate(void* block) noexcept
+   {
+      {
+         std::scoped_lock lock(m_mutex);
+         if (m_blocks.size() < maxCachedBlocks)
+         {
+            m_blocks.push_back(block);
+            return;
+         }
+      }
+
+      ::operator delete(block);
+   }
+
+private:
+   static constexpr std::size_t maxCachedBlocks = 1024;
+
+   std::mutex m_mutex; // guards m_blocks
+   std::vector<void*> m_blocks;
+};
+
+/// <summary>
+/// The allocator of the thread pool's operations, an operation which fits a cached block is kept by OperationsMemoryCache
+/// </summary>
+template <typename T>
+class OperationsAllocator
+{
+public:
+   using value_type = T;
+
+   explicit OperationsAllocator(OperationsMemoryCache& cache) noexcept : m_cache(&cache)
+   {}
+
+   template <typename U>
+   OperationsAllocator(const OperationsAllocator<U>& other) noexcept : m_cache(other.m_cache)
+   {}
+
+   T* allocate(std::size_t count)
+   {
+      if (isCached(count))
+      {
+         return static_cast<T*>(m_cache->Allocate());
+      }
+
+      return std::allocator<T>().allocate(count);
+   }
+
+   void deallocate(T* memory, std::size_t count) noexcept
+   {
+      if (isCached(count))
+      {
+         m_cache->Deallocate(memory);
+         return;
+      }
+
+      std::allocator<T>().deallocate(memory, count);
+   }
+
+   template <typename U>
+   bool operator==(const OperationsAllocator<U>& other) const noexcept
+   {
+      return m_cache == other.m_cache;
+   }
+
+   template <typename U>
+   bool operator!=(const OperationsAllocator<U>& other) const noexcept
+   {
+      return m_cache != other.m_cache;
+   }
+
+private:
+   template <typename U>
+   friend class OperationsAllocator;
+
+   static constexpr bool isCached(std::size_t count) noexcept
+   {
+      return count * sizeof(T) <= OperationsMemoryCache::blockSize && alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+   }
+
+   OperationsMemoryCache* m_cache;
+};
+
+}
+
 /// <summary>
 /// A thread pool wrapper for boost::asio::thread_pool.
 /// The passed token is ignored.
+/// The posted tasks' operations are allocated from a cache which is shared by all threads (see details::OperationsMemoryCache),
+/// so a task posted by a non-pool thread costs no heap allocation either.
 /// </summary>
 class ThreadPoolBoost
 {
+   /// <summary>
+   /// A posted task, its associated allocator is used by boost::asio for the operation which wraps it
+   /// </summary>
+   template <typename Function>
+   struct Handler
+   {
+      using allocator_type = details::OperationsAllocator<void>;
+
+      allocator_type get_allocator() const noexcept
+      {
+         return allocator_type(*cache);
+      }
+
+      void operator()()
+      {
+         function();
+      }
+
+      Function function;
+      details::OperationsMemoryCache* cache;
+   };
+
 public:
    /// <summary>
    /// Posts a task to the thread pool
@@ -21,7 +180,7 @@ public:
    template <typename Task, typename Token>
    void Post(Task&& task, Token&& /*token*/)
    {
-      boost::asio::post(m_threadPool, std::forward<Task>(task));
+      boost::asio::post(m_threadPool, Handler<std::decay_t<Task>>{ std::forward<Task>(task), &m_operationsCache });
    }
 
    /// <summary>
@@ -34,6 +193,7 @@ public:
    }
 
 private:
+   details::OperationsMemoryCache m_operationsCache; // it outlives m_threadPool, whose destruction frees the pending operations
    boost::asio::thread_pool m_threadPool;
 };
 
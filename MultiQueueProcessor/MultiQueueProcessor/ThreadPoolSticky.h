@@ -0,0 +1,439 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "IdlePolicy.h"
+#include "Task.h"
+#include "ThreadAffinity.h"
+
+namespace MQP
+{
+
+namespace details
+{
+
+/// <summary>
+/// Tokens' workers groups of ThreadPoolSticky, an open addressing hash table of atomic slots.
+/// Find is lock-free (a few atomic loads), Assign calls must be serialized by the owner.
+/// A slot keeps its token hash once it is taken, an unbound token's slot is kept with no group.
+/// The table is never more than half full, a table without a free slot for a new token is rebuilt by the owner.
+/// </summary>
+class TokenGroupsTable
+{
+public:
+   static constexpr std::size_t noGroup = std::numeric_limits<std::size_t>::max();
+
+   /// <summary>
+   /// Ctor
+   /// </summary>
+   /// <param name="capacity">Count of slots, a power of two</param>
+   explicit TokenGroupsTable(std::size_t capacity)
+      : m_slots(std::make_unique<Slot[]>(capacity))
+      , m_mask(capacity - 1)
+   {
+   }
+
+   /// <summary>
+   /// Finds a token's group
+   /// </summary>
+   /// <param name="tokenHash">A token's hash</param>
+   /// <param name="mixedHash">The token's hash mixed for the table's index</param>
+   /// <returns>The token's group or noGroup if the token is not bound</returns>
+   std::size_t Find(std::size_t tokenHash, std::size_t mixedHash) const noexcept
+   {
+      for (auto index = mixedHash & m_mask; ; index = (index + 1) & m_mask)
+      {
+         const auto& slot = m_slots[index];
+
+         // the acquire load of a taken slot's group makes its token hash visible
+         const auto groupIndex = slot.groupIndex.load(std::memory_order_acquire);
+         if (groupIndex == freeSlot)
+         {
+            return noGroup;
+         }
+
+         if (slot.tokenHash.load(std::memory_order_relaxed) == tokenHash)
+         {
+            return groupIndex;
+         }
+      }
+   }
+
+   /// <summary>
+   /// Sets a token's group
+   /// </summary>
+   /// <param name="tokenHash">A token's hash</param>
+   /// <param name="mixedHash">The token's hash mixed for the table's index</param>
+   /// <param name="groupIndex">A group or noGroup to unbind the token</param>
+   /// <returns>False if the table has no free slot for a new token</returns>
+   bool Assign(std::size_t tokenHash, std::size_t mixedHash, std::size_t groupIndex) noexcept
+   {
+      for (auto index = mixedHash & m_mask; ; index = (index + 1) & m_mask)
+      {
+         auto& slot = m_slots[index];
+
+         if (slot.groupIndex.load(std::memory_order_relaxed) == freeSlot)
+         {
+            if (groupIndex == noGroup)
+            {
+               return true;
+            }
+
+            if ((m_takenSlotsCount + 1) * 2 > m_mask + 1)
+            {
+               return false;
+            }
+
+            ++m_takenSlotsCount;
+            slot.tokenHash.store(tokenHash, std::memory_order_relaxed);
+            slot.groupIndex.store(groupIndex, std::memory_order_release);
+            return true;
+         }
+
+         if (slot.tokenHash.load(std::memory_order_relaxed) == tokenHash)
+         {
+            slot.groupIndex.store(groupIndex, std::memory_order_release);
+            return true;
+         }
+      }
+   }
+
+   /// <summary>
+   /// Calls a function for each bound token's hash and group
+   /// </summary>
+   template <typename Function>
+   void ForEachBound(Function&& function) const
+   {
+      for (std::size_t index = 0; index <= m_mask; ++index)
+      {
+         const auto groupIndex = m_slots[index].groupIndex.load(std::memory_order_relaxed);
+         if (groupIndex != freeSlot && groupIndex != noGroup)
+         {
+            function(m_slots[index].tokenHash.load(std::memory_order_relaxed), groupIndex);
+         }
+      }
+   }
+
+private:
+   static constexpr std::size_t freeSlot = noGroup - 1;
+
+   struct Slot
+   {
+      std::atomic<std::size_t> tokenHash = 0;
+      std::atomic<std::size_t> groupIndex = freeSlot; // freeSlot till the slot is taken by a token, noGroup for an unbound token
+   };
+
+   std::unique_ptr<Slot[]> m_slots;
+   std::size_t m_mask; // count of slots - 1
+   std::size_t m_takenSlotsCount = 0;
+};
+
+}
+
+/// <summary>
+/// A thread pool which runs all tasks of a token on the same worker thread.
+/// Each worker has its own queue, a task is queued to the worker selected by the token's hash,
+/// so a consumer (ConsumerProcessor passes the consumer as a token) always runs in the same thread:
+/// its working set stays in that core's caches and its thread-local state is safe ("STA simulation").
+/// A busy worker doesn't help others, so a load balance depends on the tokens distribution.
+/// An idle worker spins and parks according to the pool's ThreadPoolIdlePolicy.
+/// The workers can be split into groups pinned to CPU sets (see ThreadPoolWorkersGroup, MakeNumaWorkersGroups)
+/// and a token can be bound to a group (see BindToken), e.g. a consumer to the NUMA node where its values are stored.
+/// </summary>
+class ThreadPoolSticky
+{
+   /// <summary>
+   /// A worker thread with its own tasks queue
+   /// </summary>
+   struct alignas(64) Worker
+   {
+      std::mutex mutex; // guards tasks and isParked, isStopRequested and hasTasks are set under it
+      std::condition_variable condition;
+      std::vector<Task> tasks;
+      bool isParked = false; // whether the worker waits for the condition, so it has to be notified
+      std::atomic_bool hasTasks = false; // lets a spinning worker poll the queue without locking
+      std::atomic_bool isStopRequested = false;
+      std::vector<unsigned> cpus; // CPUs the worker is pinned to
+      std::thread thread;
+   };
+
+   /// <summary>
+   /// A range of m_workers which form a workers group
+   /// </summary>
+   struct WorkersRange
+   {
+      std::size_t first = 0;
+      std::size_t count = 0;
+   };
+
+public:
+   /// <summary>
+   /// Ctor
+   /// </summary>
+   /// <param name="threadsCount">Count of worker threads, the hardware concurrency by default</param>
+   /// <param name="idlePolicy">An idle worker's policy</param>
+   explicit ThreadPoolSticky(std::size_t threadsCount = std::thread::hardware_concurrency(), const ThreadPoolIdlePolicy& idlePolicy = {})
+      : ThreadPoolSticky(std::vector<ThreadPoolWorkersGroup>{ ThreadPoolWorkersGroup{ {}, threadsCount != 0 ? threadsCount : 1 } }, idlePolicy)
+   {
+   }
+
+   /// <summary>
+   /// Ctor
+   /// </summary>
+   /// <param name="groups">Groups of worker threads, the workers of a group are pinned to the group's CPUs</param>
+   /// <param name="idlePolicy">An idle worker's policy</param>
+   explicit ThreadPoolSticky(const std::vector<ThreadPoolWorkersGroup>& groups, const ThreadPoolIdlePolicy& idlePolicy = {})
+      : m_idlePolicy(idlePolicy)
+   {
+      for (const auto& group : groups)
+      {
+         auto threadsCount = group.threadsCount != 0 ? group.threadsCount : group.cpus.size();
+         if (threadsCount == 0)
+         {
+            threadsCount = 1;
+         }
+
+         m_groups.emplace_back(WorkersRange{ m_workers.size(), threadsCount });
+         for (std::size_t i = 0; i < threadsCount; ++i)
+         {
+            auto& worker = m_workers.emplace_back(std::make_unique<Worker>());
+            worker->cpus = group.cpus;
+         }
+      }
+
+      if (m_workers.empty())
+      {
+         m_groups.emplace_back(WorkersRange{ 0, 1 });
+         m_workers.emplace_back(std::make_unique<Worker>());
+      }
+
+      for (auto& worker : m_workers)
+      {
+         worker->thread = std::thread([this, &worker = *worker]() { run(worker); });
+      }
+   }
+
+   ~ThreadPoolSticky()
+   {
+      Stop();
+   }
+
+   ThreadPoolSticky(const ThreadPoolSticky&) = delete;
+   ThreadPoolSticky& operator=(const ThreadPoolSticky&) = delete;
+   ThreadPoolSticky(ThreadPoolSticky&&) = delete;
+   ThreadPoolSticky& operator=(ThreadPoolSticky&&) = delete;
+
+   /// <summary>
+   /// Posts a task to the thread pool
+   /// </summary>
+   /// <param name="task">A posted task</param>
+   /// <param name="token">A token for tasks grouping, all tasks of a token are run by the same thread</param>
+   template <typename TTask, typename Token>
+   void Post(TTask&& task, Token&& token)
+   {
+      auto& worker = *m_workers[getWorkerIndex(std::hash<std::decay_t<Token>>{}(token))];
+
+      bool isParked = false;
+
+      {
+         std::scoped_lock lock(worker.mutex);
+         if (worker.isStopRequested)
+         {
+            return;
+         }
+
+         worker.tasks.emplace_back(std::forward<TTask>(task));
+         worker.hasTasks.store(true, std::memory_order_release);
+         isParked = worker.isParked;
+      }
+
+      if (isParked)
+      {
+         // a busy or spinning worker takes the task without a notification
+         worker.condition.notify_one();
+      }
+   }
+
+   /// <summary>
+   /// Binds a token to a workers group, so all token's tasks are run by a worker of the group.
+   /// Tokens are told apart by their hashes. An unbound token's tasks are run by a worker of any group.
+   /// A consumer's token can be made by MakeConsumerToken.
+   /// A Post reads the bindings without locking. The binding is meant for the setup of consumers:
+   /// the bindings table grows by rebuilding and a replaced table is kept till the pool's destruction,
+   /// since a concurrent Post may still read it, so the kept tables take memory proportional to count of bound tokens.
+   /// </summary>
+   /// <param name="token">A token</param>
+   /// <param name="groupIndex">An index of a group passed to the ctor</param>
+   template <typename Token>
+   void BindToken(const Token& token, std::size_t groupIndex)
+   {
+      assignTokenGroup(std::hash<Token>{}(token), groupIndex < m_groups.size() ? groupIndex : m_groups.size() - 1);
+   }
+
+   /// <summary>
+   /// Unbinds a token from a workers group
+   /// </summary>
+   template <typename Token>
+   void UnbindToken(const Token& token)
+   {
+      assignTokenGroup(std::hash<Token>{}(token), details::TokenGroupsTable::noGroup);
+   }
+
+   /// <summary>
+   /// Gets count of the workers groups
+   /// </summary>
+   std::size_t GetGroupsCount() const
+   {
+      return m_groups.size();
+   }
+
+   /// <summary>
+   /// Stops the thread pool, the tasks which are not started yet are discarded
+   /// </summary>
+   void Stop()
+   {
+      for (auto& worker : m_workers)
+      {
+         {
+            std::scoped_lock lock(worker->mutex);
+            worker->isStopRequested = true;
+         }
+
+         worker->condition.notify_one();
+      }
+
+      for (auto& worker : m_workers)
+      {
+         if (worker->thread.joinable())
+         {
+            worker->thread.join();
+         }
+      }
+   }
+
+private:
+   static std::size_t mixHash(std::size_t tokenHash)
+   {
+      // a token is often a pointer, its low bits are the same, so the hash is mixed (Fibonacci hashing)
+      return static_cast<std::size_t>((static_cast<std::uint64_t>(tokenHash) * 0x9E3779B97F4A7C15ull) >> 32);
+   }
+
+   std::size_t getWorkerIndex(std::size_t tokenHash)
+   {
+      const auto mixed = mixHash(tokenHash);
+
+      const auto groupIndex = m_tokenGroups.load(std::memory_order_acquire)->Find(tokenHash, mixed);
+      if (groupIndex != details::TokenGroupsTable::noGroup)
+      {
+         const auto& group = m_groups[groupIndex];
+         return group.first + mixed % group.count;
+      }
+
+      return mixed % m_workers.size();
+   }
+
+   static std::vector<std::unique_ptr<details::TokenGroupsTable>> makeTokenGroupsTables()
+   {
+      std::vector<std::unique_ptr<details::TokenGroupsTable>> tables;
+      tables.push_back(std::make_unique<details::TokenGroupsTable>(minTokenGroupsCapacity));
+      return tables;
+   }
+
+   void assignTokenGroup(std::size_t tokenHash, std::size_t groupIndex)
+   {
+      std::scoped_lock lock(m_tokenGroupsMutex);
+
+      auto& table = *m_tokenGroupsTables.back();
+      if (table.Assign(tokenHash, mixHash(tokenHash), groupIndex))
+      {
+         return;
+      }
+
+      // the table is rebuilt without the unbound tokens' slots, twice as large as the bound tokens need
+      std::vector<std::pair<std::size_t, std::size_t>> bound;
+      table.ForEachBound([&bound](std::size_t boundTokenHash, std::size_t boundGroupIndex) { bound.emplace_back(boundTokenHash, boundGroupIndex); });
+      bound.emplace_back(tokenHash, groupIndex);
+
+      std::size_t capacity = minTokenGroupsCapacity;
+      while (capacity < bound.size() * 4)
+      {
+         capacity *= 2;
+      }
+
+      auto rebuilt = std::make_unique<details::TokenGroupsTable>(capacity);
+      for (const auto& [boundTokenHash, boundGroupIndex] : bound)
+      {
+         rebuilt->Assign(boundTokenHash, mixHash(boundTokenHash), boundGroupIndex);
+      }
+
+      m_tokenGroups.store(rebuilt.get(), std::memory_order_release);
+      m_tokenGroupsTables.push_back(std::move(rebuilt));
+   }
+
+   void run(Worker& worker)
+   {
+      details::PinCurrentThread(worker.cpus);
+
+      std::vector<Task> tasks; // swapped with the worker's queue, so the both keep their capacity
+
+      while (true)
+      {
+         details::SpinUntil(m_idlePolicy.spinInterval, [&worker]()
+            {
+               return worker.hasTasks.load(std::memory_order_acquire) || worker.isStopRequested.load(std::memory_order_relaxed);
+            });
+
+         {
+            std::unique_lock lock(worker.mutex);
+
+            worker.isParked = true;
+            worker.condition.wait(lock, [&worker]() { return worker.isStopRequested || !worker.tasks.empty(); });
+            worker.isParked = false;
+
+            if (worker.isStopRequested)
+            {
+               return;
+            }
+
+            // all queued tasks are taken at once, so the queue's lock is not taken per task
+            tasks.swap(worker.tasks);
+            worker.hasTasks.store(false, std::memory_order_relaxed);
+         }
+
+         for (auto& task : tasks)
+         {
+            if (worker.isStopRequested.load(std::memory_order_relaxed))
+            {
+               return;
+            }
+
+            task();
+         }
+
+         tasks.clear();
+      }
+   }
+
+private:
+   const ThreadPoolIdlePolicy m_idlePolicy;
+   std::vector<std::unique_ptr<Worker>> m_workers;
+   std::vector<WorkersRange> m_groups;
+   static constexpr std::size_t minTokenGroupsCapacity = 16;
+
+   std::mutex m_tokenGroupsMutex; // serializes BindToken and UnbindToken
+   // the current tokens' groups table is the last one, the replaced ones are kept for concurrent Post calls
+   std::vector<std::unique_ptr<details::TokenGroupsTable>> m_tokenGroupsTables = makeTokenGroupsTables();
+   std::atomic<const details::TokenGroupsTable*> m_tokenGroups = m_tokenGroupsTables.back().get(); // read by Post without locking
+};
+
+}
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "IdlePolicy.h"
+#include "Task.h"
+#include "WorkStealingDeque.h"
+
+namespace MQP
+{
+
+/// <summary>
+/// A work-stealing thread pool.
+/// Each worker has its own lock-free deque (see WorkStealingDeque): a task which is posted from a worker thread
+/// (e.g. a consumer's next notification task) is pushed to the worker's deque and the worker pops its tasks in LIFO order,
+/// so a continuation runs on the same (cache-hot) thread. An idle worker steals the oldest tasks of other workers.
+/// A task which is posted from a non worker thread is put to the shared injection queue.
+/// The passed token is ignored, ConsumerProcessor itself guarantees that a consumer's tasks are run sequentially.
+/// An idle worker spins and parks according to the pool's ThreadPoolIdlePolicy.
+/// </summary>
+class ThreadPoolWorkStealing
+{
+   /// <summary>
+   /// A worker thread with its own tasks deque
+   /// </summary>
+   struct Worker
+   {
+      WorkStealingDeque<Task> tasks;
+      std::thread thread;
+   };
+
+public:
+   /// <summary>
+   /// Ctor
+   /// </summary>
+   /// <param name="threadsCount">Count of worker threads, the hardware concurrency by default</param>
+   /// <param name="idlePolicy">An idle worker's policy</param>
+   explicit ThreadPoolWorkStealing(std::size_t threadsCount = std::thread::hardware_concurrency(), const ThreadPoolIdlePolicy& idlePolicy = {})
+      : m_idlePolicy(idlePolicy)
+   {
+      if (threadsCount == 0)
+      {
+         threadsCount = 1;
+      }
+
+      m_workers.reserve(threadsCount);
+      for (std::size_t i = 0; i < threadsCount; ++i)
+      {
+         m_workers.emplace_back(std::make_unique<Worker>());
+      }
+
+      for (std::size_t i = 0; i < threadsCount; ++i)
+      {
+         m_workers[i]->thread = std::thread([this, i]() { run(i); });
+      }
+   }
+
+   ~ThreadPoolWorkStealing()
+   {
+      Stop();
+   }
+
+   ThreadPoolWorkStealing(const ThreadPoolWorkStealing&) = delete;
+   ThreadPoolWorkStealing& operator=(const ThreadPoolWorkStealing&) = delete;
+   ThreadPoolWorkStealing(ThreadPoolWorkStealing&&) = delete;
+   ThreadPoolWorkStealing& operator=(ThreadPoolWorkStealing&&) = delete;
+
+   /// <summary>
+   /// Posts a task to the thread pool, a task posted to a stopped pool is destroyed without running
+   /// </summary>
+   /// <param name="task">A posted task</param>
+   /// <param name="token">A token for tasks grouping, it is ignored</param>
+   template <typename TTask, typename Token>
+   void Post(TTask&& task, Token&& /*token*/)
+   {
+      if (m_isStopRequested.load(std::memory_order_relaxed))
+      {
+         return;
+      }
+
+      Task* node = createNode(std::forward<TTask>(task));
+
+      auto* worker = currentWorker();
+      if (worker == nullptr || worker->pool != this || !m_workers[worker->index]->tasks.Push(node))
+      {
+         // a foreign thread or the worker's deque is full
+         std::unique_lock lock(m_injectedMutex);
+         if (m_isStopRequested.load(std::memory_order_relaxed))
+         {
+            // Stop has discarded the injected tasks already or is about to do it under the lock
+            lock.unlock();
+            recycleNode(node);
+            return;
+         }
+
+         m_injected.emplace_back(node);
+         m_injectedCount.fetch_add(1, std::memory_order_seq_cst);
+      }
+
+      wakeUpWorker();
+   }
+
+   /// <summary>
+   /// Stops the thread pool, the tasks which are not started yet are discarded.
+   /// The workers' deques are discarded after the workers are joined, the injection queue is discarded under its lock,
+   /// which a concurrent Post takes to check the stop request, so no posted task is left behind.
+   /// </summary>
+   void Stop()
+   {
+      {
+         std::scoped_lock lock(m_sleepMutex);
+         m_isStopRequested.store(true, std::memory_order_seq_cst);
+      }
+
+      m_sleepCondition.notify_all();
+
+      for (auto& worker : m_workers)
+      {
+         if (worker->thread.joinable())
+         {
+            worker->thread.join();
+         }
+      }
+
+      for (auto& worker : m_workers)
+      {
+         while (Task* node = worker->tasks.Pop())
+         {
+            delete node;
+         }
+      }
+
+      std::scoped_lock lock(m_injectedMutex);
+      for (Task* node : m_injected)
+      {
+         delete node;
+      }
+
+      m_injected.clear();
+   }
+
+private:
+   /// <summary>
+   /// Identifies the pool's worker which runs in the current thread
+   /// </summary>
+   struct WorkerIdentity
+   {
+      const ThreadPoolWorkStealing* pool = nullptr;
+      std::size_t index = 0;
+   };
+
+   static WorkerIdentity*& currentWorker()
+   {
+      thread_local WorkerIdentity* worker = nullptr;
+      return worker;
+   }
+
+   /// <summary>
+   /// Task nodes which have been run by the current thread and can be reused for new tasks,
+   /// so a steady flow of tasks posted from the workers causes no allocations
+   /// </summary>
+   static std::vector<std::unique_ptr<Task>>& taskNodesCache()
+   {
+      thread_local std::vector<std::unique_ptr<Task>> cache;
+      return cache;
+   }
+
+   static constexpr std::size_t maxCachedTaskNodes = 1024;
+
+   template <typename TTask>
+   static Task* createNode(TTask&& task)
+   {
+      auto& cache = taskNodesCache();
+      if (cache.empty())
+      {
+         return new Task(std::forward<TTask>(task));
+      }
+
+      Task* node = cache.back().release();
+      cache.pop_back();
+      *node = Task(std::forward<TTask>(task));
+      return node;
+   }
+
+   static void recycleNode(Task* node)
+   {
+      *node = Task();
+
+      auto& cache = taskNodesCache();
+      if (cache.size() < maxCachedTaskNodes)
+      {
+         cache.emplace_back(node);
+         return;
+      }
+
+      delete node;
+   }
+
+   void run(std::size_t index)
+   {
+      WorkerIdentity identity{ this, index };
+      currentWorker() = &identity;
+
+      auto& tasks = m_workers[index]->tasks;
+
+      while (!m_isStopRequested.load(std::memory_order_relaxed))
+      {
+         Task* node = tasks.Pop();
+         if (node == nullptr)
+         {
+            node = popInjected();
+         }
+
+         if (node == nullptr)
+         {
+            node = steal(index);
+         }
+
+         if (node == nullptr)
+         {
+            // a spinning worker is not counted as a sleeping one, so posting threads don't notify it
+            const bool isTaskFound = details::SpinUntil(m_idlePolicy.spinInterval, [this]()
+               {
+                  return hasTasks() || m_isStopRequested.load(std::memory_order_relaxed);
+               });
+
+            if (!isTaskFound)
+            {
+               sleep();
+            }
+
+            continue;
+         }
+
+         (*node)();
+         recycleNode(node);
+      }
+
+      currentWorker() = nullptr;
+   }
+
+   Task* popInjected()
+   {
+      if (m_injectedCount.load(std::memory_order_seq_cst) == 0)
+      {
+         return nullptr;
+      }
+
+      std::scoped_lock lock(m_injectedMutex);
+      if (m_injected.empty())
+      {
+         return nullptr;
+      }
+
+      Task* node = m_injected.front();
+      m_injected.pop_front();
+      m_injectedCount.fetch_sub(1, std::memory_order_seq_cst);
+      return node;
+   }
+
+   /// <summary>
+   /// Steals a task of other workers starting from the next one
+   /// </summary>
+   Task* steal(std::size_t thiefIndex)
+   {
+      for (std::size_t i = 1; i < m_workers.size(); ++i)
+      {
+         if (Task* node = m_workers[(thiefIndex + i) % m_workers.size()]->tasks.Steal())
+         {
+            return node;
+         }
+      }
+
+      return nullptr;
+   }
+
+   bool hasTasks() const
+   {
+      if (m_injectedCount.load(std::memory_order_seq_cst) != 0)
+      {
+         return true;
+      }
+
+      for (const auto& worker : m_workers)
+      {
+         if (!worker->tasks.IsEmpty())
+         {
+            return true;
+         }
+      }
+
+      return false;
+   }
+
+   /// <summary>
+   /// Waits for a new task. A posting thread publishes a task before it checks m_sleepingCount,
+   /// while a worker increments m_sleepingCount before it checks the tasks, so either the worker sees the task
+   /// or the posting thread sees the sleeping worker and wakes it up under m_sleepMutex.
+   /// </summary>
+   void sleep()
+   {
+      std::unique_lock lock(m_sleepMutex);
+
+      m_sleepingCount.fetch_add(1, std::memory_order_seq_cst);
+      if (!hasTasks() && !m_isStopRequested.load(std::memory_order_seq_cst))
+      {
+         m_sleepCondition.wait(lock);
+      }
+
+      m_sleepingCount.fetch_sub(1, std::memory_order_seq_cst);
+   }
+
+   void wakeUpWorker()
+   {
+      if (m_sleepingCount.load(std::memory_order_seq_cst) == 0)
+      {
+         return;
+      }
+
+      {
+         std::scoped_lock lock(m_sleepMutex); // the sleeping worker is waiting already
+      }
+
+      m_sleepCondition.notify_one();
+   }
+
+private:
+   const ThreadPoolIdlePolicy m_idlePolicy;
+   std::vector<std::unique_ptr<Worker>> m_workers;
+   std::atomic_bool m_isStopRequested = false;
+
+   std::mutex m_injectedMutex; // guards m_injected
+   std::deque<Task*> m_injected; // tasks posted from non worker threads
+   alignas(64) std::atomic_size_t m_injectedCount = 0;
+
+   std::mutex m_sleepMutex;
+   std::condition_variable m_sleepCondition;
+   alignas(64) std::atomic_size_t m_sleepingCount = 0;
+};
+
+}
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <tuple>
+#include <vector>
+
+namespace MQP
+{
+
+/// <summary>
+/// MultiQueueProcessor's tracer policy: no tracing, the hooks are empty and compile away
+/// </summary>
+struct NoTracer
+{
+   static constexpr bool isEnabled = false;
+
+   static void Begin(const char* /*name*/, std::uint64_t /*id*/ = 0) noexcept {}
+   static void End(const char* /*name*/, std::uint64_t /*id*/ = 0) noexcept {}
+   static void Instant(const char* /*name*/, std::uint64_t /*id*/ = 0) noexcept {}
+   static void FlowStart(const char* /*name*/, std::uint64_t /*id*/) noexcept {}
+   static void FlowFinish(const char* /*name*/, std::uint64_t /*id*/) noexcept {}
+};
+
+/// <summary>
+/// MultiQueueProcessor's tracer policy: the hooks write events into per-thread ring buffers without locks,
+/// the buffers can be dumped as a Chrome trace (chrome://tracing, https://ui.perfetto.dev) at any time.
+/// A thread keeps the last EventsPerThread events, the older ones are overwritten.
+/// A thread's buffer is recycled when the thread exits: it is kept with the thread's events till a new thread takes it,
+/// so the buffers count is bounded by the max count of concurrent tracing threads rather than the count of started ones.
+/// Event names must be string literals (only the pointers are kept).
+/// A flow (FlowStart, FlowFinish with the same id) links e.g. a task posting with the task's start.
+/// </summary>
+template <std::size_t EventsPerThread = 65536>
+class ChromeTracer
+{
+   static_assert(EventsPerThread > 0 && (EventsPerThread & (EventsPerThread - 1)) == 0, "The events count must be a power of two");
+
+   /// <summary>
+   /// An event record, its fields are atomic, so a dump can read a record which is being overwritten without a data race
+   /// </summary>
+   struct Event
+   {
+      std::atomic<const char*> name = nullptr;
+      std::atomic_uint64_t timestamp = 0; // ns of the steady clock
+      std::atomic_uint64_t id = 0;
+      std::atomic_char phase = 0;
+   };
+
+   /// <summary>
+   /// A thread's ring buffer, it is written by its thread only
+   /// </summary>
+   struct ThreadBuffer
+   {
+      explicit ThreadBuffer(std::size_t threadIndex) : tid(threadIndex)
+      {}
+
+      std::atomic_size_t tid; // it is changed when the buffer is taken by a new thread
+      std::atomic_uint64_t written = 0; // count of written events
+      std::atomic_uint64_t resetAt = 0; // events below are dropped by Reset
+      std::unique_ptr<Event[]> events = std::make_unique<Event[]>(EventsPerThread);
+      bool isFree = false; // whether the buffer's thread has exited, it is guarded by the registry's lock
+   };
+
+   /// <summary>
+   /// The buffers of all threads which have traced, the free ones are taken by new threads
+   /// </summary>
+   struct Registry
+   {
+      std::mutex mutex; // guards buffers, the buffers' isFree and threadsCount
+      std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+      std::size_t threadsCount = 0; // count of threads which have traced, it gives the threads' tids
+   };
+
+   /// <summary>
+   /// Holds a thread's buffer while the thread lives, the buffer is freed at the thread's exit
+   /// </summary>
+   struct ThreadBufferHolder
+   {
+      ThreadBufferHolder() : buffer(acquireBuffer())
+      {}
+
+      ThreadBufferHolder(const ThreadBufferHolder&) = delete;
+      ThreadBufferHolder& operator=(const ThreadBufferHolder&) = delete;
+
+      ~ThreadBufferHolder()
+      {
+         auto& registry = getRegistry();
+
+         std::scoped_lock lock(registry.mutex);
+         buffer->isFree = true;
+      }
+
+      const std::shared_ptr<ThreadBuffer> buffer;
+   };
+
+public:
+   static constexpr bool isEnabled = true;
+
+   static void Begin(const char* name, std::uint64_t id = 0) noexcept
+   {
+      write('B', name, id);
+   }
+
+   static void End(const char* name, std::uint64_t id = 0) noexcept
+   {
+      write('E', name, id);
+   }
+
+   static void Instant(const char* name, std::uint64_t id = 0) noexcept
+   {
+      write('i', name, id);
+   }
+
+   static void FlowStart(const char* name, std::uint64_t id) noexcept
+   {
+      write('s', name, id);
+   }
+
+   static void FlowFinish(const char* name, std::uint64_t id) noexcept
+   {
+      write('f', name, id);
+   }
+
+   /// <summary>
+   /// Drops all events written so far
+   /// </summary>
+   static void Reset()
+   {
+      auto& registry = getRegistry();
+
+      std::scoped_lock lock(registry.mutex);
+      for (const auto& buffer : registry.buffers)
+      {
+         buffer->resetAt.store(buffer->written.load(std::memory_order_acquire), std::memory_order_release);
+      }
+   }
+
+   /// <summary>
+   /// Writes the events of all threads in the Chrome trace event format (JSON).
+   /// The threads go on writing meanwhile, the events which are overwritten during the dump are skipped.
+   /// </summary>
+   static void WriteChromeTrace(std::ostream& os)
+   {
+      std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+      {
+         auto& registry = getRegistry();
+
+         std::scoped_lock lock(registry.mutex);
+         buffers = registry.buffers;
+      }
+
+      os << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+
+      bool isFirst = true;
+      for (const auto& buffer : buffers)
+      {
+         // the events of a buffer which is taken by a new thread during the dump can be attributed to the previous thread
+         const auto tid = buffer->tid.load(std::memory_order_acquire);
+
+         os << (isFirst ? "\n" : ",\n")
+            << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+            << ", \"args\": {\"name\": \"thread " << tid << "\"}}";
+         isFirst = false;
+
+         const auto written = buffer->written.load(std::memory_order_acquire);
+         const auto first = std::max(buffer->resetAt.load(std::memory_order_acquire), written > EventsPerThread ? written - EventsPerThread : 0);
+
+         std::vector<std::tuple<const char*, std::uint64_t, std::uint64_t, char>> events;
+         events.reserve(static_cast<std::size_t>(written - first));
+         for (auto i = first; i != written; ++i)
+         {
+            const auto& event = buffer->events[i & (EventsPerThread - 1)];
+            events.emplace_back(event.name.load(std::memory_order_relaxed), event.timestamp.load(std::memory_order_relaxed),
+                                event.id.load(std::memory_order_relaxed), event.phase.load(std::memory_order_relaxed));
+         }
+
+         // the events which the thread has overwritten while they were read can be torn, as well as the one it is writing
+         // (the slot of the event which is EventsPerThread before the written count), the fence keeps the re-read after the copy
+         std::atomic_thread_fence(std::memory_order_acquire);
+         const auto overwritten = buffer->written.load(std::memory_order_relaxed);
+         const auto firstIntact = overwritten >= EventsPerThread ? overwritten - EventsPerThread + 1 : 0;
+
+         for (auto i = first; i != written; ++i)
+         {
+            if (i < firstIntact)
+            {
+               continue;
+            }
+
+            const auto& [name, timestamp, id, phase] = events[static_cast<std::size_t>(i - first)];
+            os << ",\n{\"name\": \"" << name << "\", \"cat\": \"mqp\", \"ph\": \"" << phase << "\", \"ts\": " << timestamp / 1000 << '.'
+               << static_cast<char>('0' + timestamp / 100 % 10) << static_cast<char>('0' + timestamp / 10 % 10) << static_cast<char>('0' + timestamp % 10)
+               << ", \"pid\": 1, \"tid\": " << tid;
+
+            if (phase == 's' || phase == 'f')
+            {
+               os << ", \"id\": " << id << (phase == 'f' ? ", \"bp\": \"e\"" : "");
+            }
+            else if (phase == 'i')
+            {
+               os << ", \"s\": \"t\", \"args\": {\"id\": " << id << "}";
+            }
+            else
+            {
+               os << ", \"args\": {\"id\": " << id << "}";
+            }
+
+            os << "}";
+         }
+      }
+
+      os << "\n]}\n";
+   }
+
+private:
+   static void write(char phase, const char* name, std::uint64_t id) noexcept
+   {
+      auto& buffer = currentBuffer();
+
+      const auto index = buffer.written.load(std::memory_order_relaxed);
+      auto& event = buffer.events[index & (EventsPerThread - 1)];
+
+      // the previous written count is published before the slot is overwritten, a dump which reads a new field
+      // sees the count of its slot's old event as overwritten (see WriteChromeTrace)
+      std::atomic_thread_fence(std::memory_order_release);
+
+      event.name.store(name, std::memory_order_relaxed);
+      event.timestamp.store(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::steady_clock::now().time_since_epoch()).count()), std::memory_order_relaxed);
+      event.id.store(id, std::memory_order_relaxed);
+      event.phase.store(phase, std::memory_order_relaxed);
+
+      buffer.written.store(index + 1, std::memory_order_release);
+   }
+
+   /// <summary>
+   /// Gets the current thread's buffer, it is taken at the thread's first event and is freed at the thread's exit
+   /// </summary>
+   static ThreadBuffer& currentBuffer()
+   {
+      thread_local ThreadBufferHolder holder;
+      return *holder.buffer;
+   }
+
+   /// <summary>
+   /// Takes a free buffer for a new thread, the previous thread's events are dropped, or registers a new buffer
+   /// </summary>
+   static std::shared_ptr<ThreadBuffer> acquireBuffer()
+   {
+      auto& registry = getRegistry();
+
+      std::scoped_lock lock(registry.mutex);
+
+      const auto tid = ++registry.threadsCount;
+      for (const auto& buffer : registry.buffers)
+      {
+         if (buffer->isFree)
+         {
+            buffer->isFree = false;
+            buffer->resetAt.store(buffer->written.load(std::memory_order_relaxed), std::memory_order_release);
+            buffer->tid.store(tid, std::memory_order_release);
+            return buffer;
+         }
+      }
+
+      return registry.buffers.emplace_back(std::make_shared<ThreadBuffer>(tid));
+   }
+
+   static Registry& getRegistry()
+   {
+      static Registry registry;
+      return registry;
+   }
+};
+
+namespace details
+{
+
+/// <summary>
+/// Traces a scope as a Begin/End pair, it is empty for NoTracer
+/// </summary>
+template <typename TTracer>
+class TraceScope
+{
+public:
+   TraceScope(const char* name, std::uint64_t id = 0) noexcept : m_name(name), m_id(id)
+   {
+      TTracer::Begin(m_name, m_id);
+   }
+
+   ~TraceScope()
+   {
+      TTracer::End(m_name, m_id);
+   }
+
+   TraceScope(const TraceScope&) = delete;
+   TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+   const char* const m_name;
+   const std::uint64_t m_id;
+};
+
+template <>
+class TraceScope<NoTracer>
+{
+public:
+   TraceScope(const char* /*name*/, std::uint64_t /*id*/ = 0) noexcept
+   {}
+};
+
+}
+
+}
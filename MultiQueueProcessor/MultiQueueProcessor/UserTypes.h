@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -22,7 +23,7 @@ struct MyKey
    }
 };
 
-std::ostream& operator<<(std::ostream& os, const MyKey& key)
+inline std::ostream& operator<<(std::ostream& os, const MyKey& key)
 {
    os << "<" << key.Value << ">";
    return os;
@@ -81,9 +82,9 @@ struct MyVal
    std::string S;
    static std::atomic_uint32_t _copyAndCreateCallsCount;
 };
-std::atomic_uint32_t MyVal::_copyAndCreateCallsCount = 0;
+inline std::atomic_uint32_t MyVal::_copyAndCreateCallsCount = 0;
 
-std::ostream& operator<<(std::ostream& os, const MyVal& val)
+inline std::ostream& operator<<(std::ostream& os, const MyVal& val)
 {
    os << "[" << val.S << "]";
    return os;
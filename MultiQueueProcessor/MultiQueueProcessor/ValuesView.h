@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+
+#include <assert.h>
+
+namespace MQP
+{
+
+/// <summary>
+/// A non-owning read-only view of values which are laid out in memory with a fixed stride,
+/// e.g. values kept contiguously or values kept as a field of contiguous records.
+/// The view refers to the storage of a value source, no value is copied.
+/// </summary>
+template <typename Value>
+class ValuesView
+{
+public:
+   class Iterator
+   {
+   public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = Value;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const Value*;
+      using reference = const Value&;
+
+      Iterator() = default;
+
+      Iterator(const std::byte* position, std::size_t stride) noexcept : m_position(position), m_stride(stride)
+      {}
+
+      reference operator*() const noexcept
+      {
+         return *reinterpret_cast<pointer>(m_position);
+      }
+
+      pointer operator->() const noexcept
+      {
+         return reinterpret_cast<pointer>(m_position);
+      }
+
+      Iterator& operator++() noexcept
+      {
+         m_position += m_stride;
+         return *this;
+      }
+
+      Iterator operator++(int) noexcept
+      {
+         auto previous = *this;
+         ++*this;
+         return previous;
+      }
+
+      bool operator==(const Iterator& rhs) const noexcept
+      {
+         return m_position == rhs.m_position;
+      }
+
+      bool operator!=(const Iterator& rhs) const noexcept
+      {
+         return !(*this == rhs);
+      }
+
+   private:
+      const std::byte* m_position = nullptr;
+      std::size_t m_stride = sizeof(Value);
+   };
+
+   ValuesView() = default;
+
+   /// <summary>
+   /// Ctor
+   /// </summary>
+   /// <param name="first">The first value.</param>
+   /// <param name="size">Count of values.</param>
+   /// <param name="stride">Distance in bytes between neighbouring values.</param>
+   ValuesView(const Value* first, std::size_t size, std::size_t stride = sizeof(Value)) noexcept
+      : m_first(reinterpret_cast<const std::byte*>(first))
+      , m_size(size)
+      , m_stride(stride)
+   {}
+
+   std::size_t size() const noexcept
+   {
+      return m_size;
+   }
+
+   bool empty() const noexcept
+   {
+      return m_size == 0;
+   }
+
+   const Value& operator[](std::size_t index) const noexcept
+   {
+      assert(index < m_size);
+      return *reinterpret_cast<const Value*>(m_first + index * m_stride);
+   }
+
+   const Value& front() const noexcept
+   {
+      return (*this)[0];
+   }
+
+   const Value& back() const noexcept
+   {
+      return (*this)[m_size - 1];
+   }
+
+   Iterator begin() const noexcept
+   {
+      return Iterator(m_first, m_stride);
+   }
+
+   Iterator end() const noexcept
+   {
+      return Iterator(m_first + m_size * m_stride, m_stride);
+   }
+
+   /// <summary>
+   /// Distance in bytes between neighbouring values
+   /// </summary>
+   std::size_t stride() const noexcept
+   {
+      return m_stride;
+   }
+
+   /// <summary>
+   /// Whether the values are laid out contiguously, so data() can be used as an array
+   /// </summary>
+   bool IsContiguous() const noexcept
+   {
+      return m_stride == sizeof(Value) || m_size <= 1;
+   }
+
+   const Value* data() const noexcept
+   {
+      return reinterpret_cast<const Value*>(m_first);
+   }
+
+private:
+   const std::byte* m_first = nullptr;
+   std::size_t m_size = 0;
+   std::size_t m_stride = sizeof(Value);
+};
+
+}
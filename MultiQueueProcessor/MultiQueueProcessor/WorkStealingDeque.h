@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace MQP
+{
+
+/// <summary>
+/// A bounded lock-free work-stealing deque of pointers (Chase-Lev).
+/// The owner thread pushes and pops at the bottom (LIFO), other threads steal from the top (FIFO).
+/// An item which is pushed by the owner becomes visible to a thief together with the pointed object.
+/// </summary>
+template <typename T, std::size_t Capacity = 1024>
+class WorkStealingDeque
+{
+   static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "The deque capacity must be a power of two");
+
+   static constexpr std::int64_t mask = Capacity - 1;
+
+public:
+   WorkStealingDeque() : m_items(std::make_unique<std::atomic<T*>[]>(Capacity))
+   {}
+
+   WorkStealingDeque(const WorkStealingDeque&) = delete;
+   WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+   WorkStealingDeque(WorkStealingDeque&&) = delete;
+   WorkStealingDeque& operator=(WorkStealingDeque&&) = delete;
+
+   /// <summary>
+   /// Pushes an item to the bottom, must be called by the owner only
+   /// </summary>
+   /// <returns>False in case the deque is full</returns>
+   bool Push(T* item)
+   {
+      const auto bottom = m_bottom.load(std::memory_order_relaxed);
+      const auto top = m_top.load(std::memory_order_acquire);
+      if (bottom - top >= static_cast<std::int64_t>(Capacity))
+      {
+         return false;
+      }
+
+      m_items[bottom & mask].store(item, std::memory_order_relaxed);
+      m_bottom.store(bottom + 1, std::memory_order_seq_cst); // publishes the item (and the object) to thieves
+
+      return true;
+   }
+
+   /// <summary>
+   /// Pops an item from the bottom, must be called by the owner only
+   /// </summary>
+   /// <returns>The popped item or nullptr if the deque is empty</returns>
+   T* Pop()
+   {
+      const auto bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+      m_bottom.store(bottom, std::memory_order_seq_cst);
+      auto top = m_top.load(std::memory_order_seq_cst);
+
+      if (top > bottom)
+      {
+         m_bottom.store(bottom + 1, std::memory_order_relaxed);
+         return nullptr;
+      }
+
+      T* item = m_items[bottom & mask].load(std::memory_order_relaxed);
+      if (top == bottom)
+      {
+         // the last item, a thief can take it concurrently
+         if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+         {
+            item = nullptr;
+         }
+
+         m_bottom.store(bottom + 1, std::memory_order_relaxed);
+      }
+
+      return item;
+   }
+
+   /// <summary>
+   /// Steals an item from the top, can be called by any thread
+   /// </summary>
+   /// <returns>The stolen item or nullptr if the deque is empty or another thread has taken the item</returns>
+   T* Steal()
+   {
+      auto top = m_top.load(std::memory_order_seq_cst);
+      const auto bottom = m_bottom.load(std::memory_order_seq_cst);
+      if (top >= bottom)
+      {
+         return nullptr;
+      }
+
+      T* item = m_items[top & mask].load(std::memory_order_relaxed);
+      if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      {
+         return nullptr;
+      }
+
+      return item;
+   }
+
+   /// <summary>
+   /// Whether the deque looks empty, the result is approximate in case of concurrent modifications
+   /// </summary>
+   bool IsEmpty() const
+   {
+      return m_bottom.load(std::memory_order_seq_cst) <= m_top.load(std::memory_order_seq_cst);
+   }
+
+private:
+   alignas(64) std::atomic_int64_t m_top = 0; // the next item to steal
+   alignas(64) std::atomic_int64_t m_bottom = 0; // the next free slot of the owner
+   const std::unique_ptr<std::atomic<T*>[]> m_items;
+};
+
+}
@@ -9,6 +9,8 @@
 #ifndef PCH_H
 #define PCH_H
 
+#ifdef _WIN32
 #include <SDKDDKVer.h>
+#endif
 
 #endif //PCH_H
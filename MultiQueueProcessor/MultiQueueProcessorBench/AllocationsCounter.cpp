@@ -0,0 +1,77 @@
+// The file replaces the global allocation functions for counting of heap allocations (see MQPBench::AllocationsCount)
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "Bench.h"
+
+namespace
+{
+std::atomic_size_t allocationsCount = 0;
+}
+
+std::size_t MQPBench::AllocationsCount()
+{
+   return allocationsCount.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size)
+{
+   allocationsCount.fetch_add(1, std::memory_order_relaxed);
+
+   if (void* memory = std::malloc(size != 0 ? size : 1))
+   {
+      return memory;
+   }
+
+   throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+   std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t /*size*/) noexcept
+{
+   std::free(memory);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+   allocationsCount.fetch_add(1, std::memory_order_relaxed);
+
+   const auto alignmentSize = static_cast<std::size_t>(alignment);
+#ifdef _WIN32
+   void* memory = _aligned_malloc(size != 0 ? size : 1, alignmentSize);
+#else
+   // aligned_alloc requires the size to be a multiple of the alignment
+   void* memory = std::aligned_alloc(alignmentSize, (std::max<std::size_t>(size, 1) + alignmentSize - 1) / alignmentSize * alignmentSize);
+#endif
+   if (memory)
+   {
+      return memory;
+   }
+
+   throw std::bad_alloc();
+}
+
+void operator delete(void* memory, std::align_val_t /*alignment*/) noexcept
+{
+#ifdef _WIN32
+   _aligned_free(memory);
+#else
+   std::free(memory);
+#endif
+}
+
+void operator delete(void* memory, std::size_t /*size*/, std::align_val_t alignment) noexcept
+{
+   operator delete(memory, alignment);
+}
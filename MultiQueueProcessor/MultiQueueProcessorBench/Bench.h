@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace MQPBench
+{
+
+/// <summary>
+/// Measures time elapsed since its creation
+/// </summary>
+class Stopwatch
+{
+public:
+   double ElapsedNs() const
+   {
+      return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - m_start).count();
+   }
+
+private:
+   const std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+};
+
+/// <summary>
+/// Gets the count of heap allocations (operator new calls) made by the process so far
+/// </summary>
+std::size_t AllocationsCount();
+
+/// <summary>
+/// Gets a percentile of samples, the samples are partially reordered
+/// </summary>
+/// <param name="percentile">A percentile in [0, 100]</param>
+inline double Percentile(std::vector<double>& samples, double percentile)
+{
+   if (samples.empty())
+   {
+      return 0;
+   }
+
+   const auto index = std::min(samples.size() - 1, static_cast<std::size_t>(percentile / 100 * samples.size()));
+   std::nth_element(std::begin(samples), std::begin(samples) + index, std::end(samples));
+   return samples[index];
+}
+
+/// <summary>
+/// A benchmark result
+/// </summary>
+struct Result
+{
+   std::string benchmark;
+   std::string parameters;
+   std::string metric;
+   double value = 0;
+};
+
+/// <summary>
+/// Gets all results reported so far
+/// </summary>
+inline std::vector<Result>& Results()
+{
+   static std::vector<Result> results;
+   return results;
+}
+
+/// <summary>
+/// Prints a benchmark result and keeps it for WriteJson
+/// </summary>
+/// <param name="benchmark">A benchmark name</param>
+/// <param name="parameters">A benchmark parameters description</param>
+/// <param name="metric">A measured metric name</param>
+/// <param name="value">A measured metric value</param>
+inline void Report(const std::string& benchmark, const std::string& parameters, const std::string& metric, double value)
+{
+   std::stringstream ss;
+   ss << benchmark << " [" << parameters << "] " << metric << ": " << value << std::endl;
+   std::cout << ss.str();
+
+   Results().emplace_back(Result{ benchmark, parameters, metric, value });
+}
+
+namespace details
+{
+
+inline std::string JsonString(const std::string& text)
+{
+   std::string json = "\"";
+   for (const char c : text)
+   {
+      switch (c)
+      {
+      case '"': json += "\\\""; break;
+      case '\\': json += "\\\\"; break;
+      case '\n': json += "\\n"; break;
+      case '\t': json += "\\t"; break;
+      default:
+         if (static_cast<unsigned char>(c) < 0x20)
+         {
+            constexpr char hexDigits[] = "0123456789abcdef";
+            json += "\\u00";
+            json += hexDigits[(c >> 4) & 0xf];
+            json += hexDigits[c & 0xf];
+         }
+         else
+         {
+            json += c;
+         }
+      }
+   }
+
+   return json + "\"";
+}
+
+}
+
+/// <summary>
+/// Writes all reported results as a JSON document: {"results": [{"benchmark", "parameters", "metric", "value"}, ...]}
+/// </summary>
+inline void WriteJson(std::ostream& os)
+{
+   os << "{\n  \"results\": [";
+
+   const auto& results = Results();
+   for (std::size_t i = 0; i < results.size(); ++i)
+   {
+      const auto& result = results[i];
+      os << (i == 0 ? "\n" : ",\n")
+         << "    {\"benchmark\": " << details::JsonString(result.benchmark)
+         << ", \"parameters\": " << details::JsonString(result.parameters)
+         << ", \"metric\": " << details::JsonString(result.metric)
+         << ", \"value\": " << (std::isfinite(result.value) ? result.value : 0) << "}";
+   }
+
+   os << "\n  ]\n}\n";
+}
+
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "MultiQueueProcessor.h"
+#include "ThreadPoolBoost.h"
+#include "Bench.h"
+
+namespace MQPBench
+{
+
+/// <summary>
+/// Measures a slow consumer of a key under a bursty producer: the count of consumer calls, the max count of retained values
+/// and the time the consumer takes to catch up with the last value after the producer's end.
+/// The conflating tuning is expected to keep the retained values and the calls bounded, the other ones queue every value.
+/// </summary>
+template <MQP::ETuning TUNING>
+void BenchConflation(const std::string& tuningName)
+{
+   constexpr std::int64_t burstsCount = 100;
+   constexpr std::int64_t burstSize = 1'000;
+
+   struct SlowConsumer : MQP::IConsumer<int, std::int64_t>
+   {
+      void Consume(const int& /*key*/, const std::int64_t& value) noexcept override
+      {
+         // the consumer's work
+         const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(2);
+         while (std::chrono::steady_clock::now() < deadline)
+         {
+         }
+
+         ++callsCount;
+         lastValue.store(value, std::memory_order_release);
+      }
+
+      std::size_t callsCount = 0;
+      std::atomic<std::int64_t> lastValue = -1;
+   };
+
+   auto threadPool = std::make_shared<MQP::ThreadPoolBoost>();
+
+   MQP::MultiQueueProcessor<int, std::int64_t, MQP::ThreadPoolBoost, TUNING> processor(threadPool);
+
+   auto consumer = std::make_shared<SlowConsumer>();
+   processor.Subscribe(0, consumer);
+
+   std::size_t maxRetainedCount = 0;
+   for (std::int64_t burst = 0; burst < burstsCount; ++burst)
+   {
+      for (std::int64_t i = 0; i < burstSize; ++i)
+      {
+         processor.Enqueue(0, burst * burstSize + i);
+      }
+
+      maxRetainedCount = std::max(maxRetainedCount, processor.GetStats().keys.front().storage.retainedValuesCount);
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+   }
+
+   Stopwatch stopwatch;
+   while (consumer->lastValue.load(std::memory_order_acquire) != burstsCount * burstSize - 1)
+   {
+      std::this_thread::yield();
+   }
+
+   const auto catchUpNs = stopwatch.ElapsedNs();
+
+   processor.Unsubscribe(0, consumer);
+   threadPool->Stop();
+
+   Report("Conflation", tuningName + ", 100 bursts of 1000 values", "consumer calls", static_cast<double>(consumer->callsCount));
+   Report("Conflation", tuningName + ", 100 bursts of 1000 values", "max retained values", static_cast<double>(maxRetainedCount));
+   Report("Conflation", tuningName + ", 100 bursts of 1000 values", "catch-up ms", catchUpNs / 1e6);
+}
+
+}
@@ -0,0 +1,375 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MultiQueueProcessor.h"
+#include "ThreadPoolBoost.h"
+#include "Bench.h"
+
+namespace MQPBench
+{
+
+namespace details
+{
+
+template <typename Key, typename Value>
+struct CountingConsumer : MQP::IConsumer<Key, Value>
+{
+   void Consume(const Key& /*key*/, const Value& /*value*/) noexcept override
+   {
+      consumed.fetch_add(1, std::memory_order_release);
+   }
+
+   std::atomic_size_t consumed = 0;
+};
+
+template <typename Key, typename Value>
+struct CountingBatchConsumer : MQP::IBatchConsumer<Key, Value>
+{
+   void ConsumeBatch(const Key& /*key*/, const MQP::ValuesView<Value>& values) noexcept override
+   {
+      consumed.fetch_add(values.size(), std::memory_order_release);
+   }
+
+   std::atomic_size_t consumed = 0;
+};
+
+/// <summary>
+/// The consumer holds the first Consume call till it is released, so a backlog can be accumulated
+/// </summary>
+template <typename Key, typename Value>
+struct GatedConsumer : CountingConsumer<Key, Value>
+{
+   void Consume(const Key& key, const Value& value) noexcept override
+   {
+      while (!isReleased.load(std::memory_order_acquire))
+      {
+         std::this_thread::yield();
+      }
+
+      CountingConsumer<Key, Value>::Consume(key, value);
+   }
+
+   std::atomic_bool isReleased = false;
+};
+
+/// <summary>
+/// The consumer gets a value enqueuing time (steady clock ticks) and keeps the notification latencies
+/// </summary>
+template <typename Key>
+struct LatencyConsumer : MQP::IConsumer<Key, std::int64_t>
+{
+   void Consume(const Key& /*key*/, const std::int64_t& enqueueTime) noexcept override
+   {
+      const auto now = std::chrono::steady_clock::now().time_since_epoch();
+      latencies.emplace_back(std::chrono::duration<double, std::nano>(now - std::chrono::steady_clock::duration(enqueueTime)).count());
+      consumed.fetch_add(1, std::memory_order_release);
+   }
+
+   std::vector<double> latencies; // ns
+   std::atomic_size_t consumed = 0;
+};
+
+}
+
+/// <summary>
+/// Measures a consumer's throughput depending on the ConsumerProcessor's drain quantum.
+/// A backlog of values is enqueued for a single key at once, the time till all of them are consumed is measured.
+/// </summary>
+inline void BenchDrainQuantum()
+{
+   constexpr std::size_t valuesCount = 1'000'000;
+
+   const std::vector<int> values(valuesCount, 0);
+
+   for (const std::size_t drainQuantumCount : { 1, 16, 256 })
+   {
+      auto threadPool = std::make_shared<MQP::ThreadPoolBoost>();
+
+      MQP::MultiQueueProcessorSettings settings;
+      settings.consumerProcessorSettings.drainQuantumCount = drainQuantumCount;
+
+      MQP::MultiQueueProcessor<int, int, MQP::ThreadPoolBoost, MQP::ETuning::size> processor(threadPool, settings);
+
+      auto consumer = std::make_shared<details::CountingConsumer<int, int>>();
+      processor.Subscribe(0, consumer);
+
+      Stopwatch stopwatch;
+
+      processor.EnqueueRange(0, std::begin(values), std::end(values));
+
+      while (consumer->consumed.load(std::memory_order_acquire) != valuesCount)
+      {
+         std::this_thread::yield();
+      }
+
+      Report("Consume throughput", "drain quantum " + std::to_string(drainQuantumCount), "ns/value", stopwatch.ElapsedNs() / valuesCount);
+
+      processor.Unsubscribe(0, consumer);
+      threadPool->Stop();
+   }
+}
+
+/// <summary>
+/// Measures a batch consumer's throughput for every data management strategy.
+/// A backlog of values is enqueued for a single key at once, the time till all of them are consumed is measured.
+/// </summary>
+template <MQP::ETuning TUNING>
+void BenchBatchConsumer(const std::string& tuningName)
+{
+   constexpr std::size_t valuesCount = 1'000'000;
+
+   const std::vector<int> values(valuesCount, 0);
+
+   auto threadPool = std::make_shared<MQP::ThreadPoolBoost>();
+
+   MQP::MultiQueueProcessor<int, int, MQP::ThreadPoolBoost, TUNING> processor(threadPool);
+
+   auto consumer = std::make_shared<details::CountingBatchConsumer<int, int>>();
+   processor.Subscribe(0, consumer);
+
+   Stopwatch stopwatch;
+
+   processor.EnqueueRange(0, std::begin(values), std::end(values));
+
+   while (consumer->consumed.load(std::memory_order_acquire) != valuesCount)
+   {
+      std::this_thread::yield();
+   }
+
+   Report("Batch consume throughput", tuningName, "ns/value", stopwatch.ElapsedNs() / valuesCount);
+
+   processor.Unsubscribe(0, consumer);
+   threadPool->Stop();
+}
+
+/// <summary>
+/// Counts heap allocations per consumed value while a consumer drains a backlog value by value (drain quantum 1),
+/// i.e. the cost of a consumer notification task creation and its passing to the thread pool.
+/// The values are added before the measurement, so their storage allocations are not counted.
+/// </summary>
+inline void BenchTaskAllocations()
+{
+   constexpr std::size_t valuesCount = 100'000;
+
+   const std::vector<int> values(valuesCount, 0);
+
+   auto threadPool = std::make_shared<MQP::ThreadPoolBoost>();
+
+   MQP::MultiQueueProcessor<int, int, MQP::ThreadPoolBoost, MQP::ETuning::size> processor(threadPool);
+
+   auto consumer = std::make_shared<details::GatedConsumer<int, int>>();
+   processor.Subscribe(0, consumer);
+
+   processor.EnqueueRange(0, std::begin(values), std::end(values));
+
+   const auto allocationsBefore = AllocationsCount();
+   consumer->isReleased.store(true, std::memory_order_release);
+
+   while (consumer->consumed.load(std::memory_order_acquire) != valuesCount)
+   {
+      std::this_thread::yield();
+   }
+
+   Report("Consumer notification task", "drain quantum 1", "allocations/value", static_cast<double>(AllocationsCount() - allocationsBefore) / valuesCount);
+
+   processor.Unsubscribe(0, consumer);
+   threadPool->Stop();
+}
+
+/// <summary>
+/// Counts heap allocations per consumed value while values are enqueued and consumed one at a time, so each value
+/// passes the consumer from idle to scheduled and back and its notification task is posted from a non-pool thread.
+/// The count includes the values storage allocations, they are amortized by the storage blocks.
+/// </summary>
+template <MQP::ETuning TUNING>
+void BenchSteadyStateAllocations(const std::string& tuningName)
+{
+   constexpr std::size_t valuesCount = 100'000;
+   constexpr std::size_t warmUpCount = 1'000;
+
+   auto threadPool = std::make_shared<MQP::ThreadPoolBoost>();
+
+   MQP::MultiQueueProcessor<int, int, MQP::ThreadPoolBoost, TUNING> processor(threadPool);
+
+   auto consumer = std::make_shared<details::CountingConsumer<int, int>>();
+   processor.Subscribe(0, consumer);
+
+   std::size_t allocationsBefore = 0;
+   for (std::size_t i = 0; i < warmUpCount + valuesCount; ++i)
+   {
+      if (i == warmUpCount)
+      {
+         allocationsBefore = AllocationsCount();
+      }
+
+      processor.Enqueue(0, 0);
+      while (consumer->consumed.load(std::memory_order_acquire) != i + 1)
+      {
+         std::this_thread::yield();
+      }
+   }
+
+   Report("Consumer notification task", tuningName + ", one value at a time", "allocations/value",
+          static_cast<double>(AllocationsCount() - allocationsBefore) / valuesCount);
+
+   processor.Unsubscribe(0, consumer);
+   threadPool->Stop();
+}
+
+/// <summary>
+/// Measures a consumer's throughput with the instrumentation policy and reports the recorded latency histograms.
+/// Values are enqueued for a few keys one by one while the consumer drains them.
+/// </summary>
+template <typename TInstrumentation>
+void BenchInstrumentation(const std::string& instrumentationName)
+{
+   constexpr std::size_t valuesCount = 1'000'000;
+   constexpr int keysCount = 4;
+
+   auto threadPool = std::make_shared<MQP::ThreadPoolBoost>();
+
+   MQP::MultiQueueProcessor<int, int, MQP::ThreadPoolBoost, MQP::ETuning::size, std::hash<int>, TInstrumentation> processor(threadPool);
+
+   auto consumer = std::make_shared<details::CountingConsumer<int, int>>();
+   for (int key = 0; key < keysCount; ++key)
+   {
+      processor.Subscribe(key, consumer);
+   }
+
+   Stopwatch stopwatch;
+
+   for (std::size_t i = 0; i < valuesCount; ++i)
+   {
+      processor.Enqueue(static_cast<int>(i % keysCount), 0);
+   }
+
+   while (consumer->consumed.load(std::memory_order_acquire) != valuesCount)
+   {
+      std::this_thread::yield();
+   }
+
+   Report("Instrumented throughput", instrumentationName, "ns/value", stopwatch.ElapsedNs() / valuesCount);
+
+   if constexpr (TInstrumentation::isEnabled)
+   {
+      const auto snapshot = processor.GetLatencySnapshot();
+      const auto& histograms = snapshot.consumers.at(consumer);
+
+      Report("Instrumented latency", "enqueue->dispatch", "p50 ns", static_cast<double>(histograms.enqueueToDispatch.GetValueAtPercentile(50)));
+      Report("Instrumented latency", "enqueue->dispatch", "p99 ns", static_cast<double>(histograms.enqueueToDispatch.GetValueAtPercentile(99)));
+      Report("Instrumented latency", "dispatch->consumed", "p50 ns", static_cast<double>(histograms.dispatchToConsumed.GetValueAtPercentile(50)));
+      Report("Instrumented latency", "dispatch->consumed", "p99 ns", static_cast<double>(histograms.dispatchToConsumed.GetValueAtPercentile(99)));
+   }
+
+   for (int key = 0; key < keysCount; ++key)
+   {
+      processor.Unsubscribe(key, consumer);
+   }
+
+   threadPool->Stop();
+}
+
+/// <summary>
+/// Measures a consumer's throughput with the tracer policy, an enabled tracer's events are dumped as a Chrome trace
+/// and the dump's time and size are reported. Values are enqueued for a few keys one by one while the consumer drains them.
+/// </summary>
+template <typename TTracer>
+void BenchTracer(const std::string& tracerName)
+{
+   constexpr std::size_t valuesCount = 1'000'000;
+   constexpr int keysCount = 4;
+
+   auto threadPool = std::make_shared<MQP::ThreadPoolBoost>();
+
+   MQP::MultiQueueProcessor<int, int, MQP::ThreadPoolBoost, MQP::ETuning::size, std::hash<int>, MQP::NoInstrumentation, TTracer> processor(threadPool);
+
+   auto consumer = std::make_shared<details::CountingConsumer<int, int>>();
+   for (int key = 0; key < keysCount; ++key)
+   {
+      processor.Subscribe(key, consumer);
+   }
+
+   Stopwatch stopwatch;
+
+   for (std::size_t i = 0; i < valuesCount; ++i)
+   {
+      processor.Enqueue(static_cast<int>(i % keysCount), 0);
+   }
+
+   while (consumer->consumed.load(std::memory_order_acquire) != valuesCount)
+   {
+      std::this_thread::yield();
+   }
+
+   Report("Traced throughput", tracerName, "ns/value", stopwatch.ElapsedNs() / valuesCount);
+
+   if constexpr (TTracer::isEnabled)
+   {
+      std::ostringstream trace;
+
+      Stopwatch dumpStopwatch;
+      TTracer::WriteChromeTrace(trace);
+      const auto dumpNs = dumpStopwatch.ElapsedNs();
+
+      Report("Trace dump", tracerName, "ms", dumpNs / 1'000'000);
+      Report("Trace dump", tracerName, "KB", static_cast<double>(trace.str().size()) / 1024);
+
+      TTracer::Reset();
+   }
+
+   for (int key = 0; key < keysCount; ++key)
+   {
+      processor.Unsubscribe(key, consumer);
+   }
+
+   threadPool->Stop();
+}
+
+/// <summary>
+/// Measures a value notification latency (from Enqueue till Consume) of a lightly loaded key,
+/// a value is enqueued when the previous one has been consumed, so the consumer is always free.
+/// </summary>
+/// <param name="parameters">A thread pool and its settings description for the report</param>
+/// <param name="threadPool">A thread pool which is used for the consumer notification</param>
+/// <param name="isInlineDispatchEnabled">Whether the consumer is notified in the enqueuing thread</param>
+template <typename TPool>
+void BenchNotificationLatency(const std::string& parameters, std::shared_ptr<TPool> threadPool, bool isInlineDispatchEnabled = false)
+{
+   constexpr std::size_t valuesCount = 20'000;
+
+   MQP::MultiQueueProcessorSettings settings;
+   settings.consumerProcessorSettings.isInlineDispatchEnabled = isInlineDispatchEnabled;
+
+   MQP::MultiQueueProcessor<int, std::int64_t, TPool, MQP::ETuning::size> processor(threadPool, settings);
+
+   auto consumer = std::make_shared<details::LatencyConsumer<int>>();
+   consumer->latencies.reserve(valuesCount);
+   processor.Subscribe(0, consumer);
+
+   for (std::size_t i = 0; i < valuesCount; ++i)
+   {
+      processor.Enqueue(0, static_cast<std::int64_t>(std::chrono::steady_clock::now().time_since_epoch().count()));
+
+      while (consumer->consumed.load(std::memory_order_acquire) != i + 1)
+      {
+         std::this_thread::yield();
+      }
+   }
+
+   processor.Unsubscribe(0, consumer);
+   threadPool->Stop();
+
+   Report("Notification latency", parameters, "p50 ns", Percentile(consumer->latencies, 50));
+   Report("Notification latency", parameters, "p99 ns", Percentile(consumer->latencies, 99));
+   Report("Notification latency", parameters, "p99.9 ns", Percentile(consumer->latencies, 99.9));
+}
+
+}
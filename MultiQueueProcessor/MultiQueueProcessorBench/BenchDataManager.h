@@ -0,0 +1,196 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DataManager.h"
+#include "DataManagerFavorSpeed.h"
+#include "Bench.h"
+
+namespace MQPBench
+{
+
+namespace details
+{
+
+template <typename Key, typename Value>
+struct NullValueSourceConsumer : MQP::IValueSourceConsumer<Key, Value>
+{
+   void OnNewValueAvailable(MQP::IValueSourcePtr<Key, Value> /*valueSource*/) override
+   {
+   }
+};
+
+}
+
+/// <summary>
+/// Measures DataManager's Locator::MoveNext cost depending on a backlog depth.
+/// A slow locator stays at the backlog's head, while a fast one moves over the values added after the backlog,
+/// after that the slow locator drains the whole storage, so every its MoveNext reclaims a value.
+/// The both costs are expected to be flat regardless of the backlog depth.
+/// </summary>
+/// <param name="storageName">A storage policy name for the report</param>
+template <typename StoragePolicy>
+void BenchMoveNextBacklog(const std::string& storageName)
+{
+   constexpr std::size_t movesCount = 1'000'000;
+
+   for (const std::size_t backlog : { 0, 1'000, 100'000, 1'000'000 })
+   {
+      auto dataManager = std::make_shared<MQP::DataManager<int, int, StoragePolicy>>(0);
+      auto consumer = std::make_shared<details::NullValueSourceConsumer<int, int>>();
+
+      auto slowLocator = dataManager->CreateValueSource(consumer);
+      auto fastLocator = dataManager->CreateValueSource(consumer);
+
+      for (std::size_t i = 0; i < backlog + movesCount; ++i)
+      {
+         dataManager->AddValue(static_cast<int>(i));
+      }
+
+      for (std::size_t i = 0; i < backlog; ++i)
+      {
+         fastLocator->MoveNext();
+      }
+
+      {
+         Stopwatch stopwatch;
+         for (std::size_t i = 0; i < movesCount; ++i)
+         {
+            fastLocator->MoveNext();
+         }
+
+         Report("MoveNext (fast locator)", storageName + ", backlog " + std::to_string(backlog), "ns/op", stopwatch.ElapsedNs() / movesCount);
+      }
+
+      {
+         Stopwatch stopwatch;
+         while (slowLocator->MoveNext())
+         {
+         }
+
+         Report("MoveNext (slowest locator)", storageName + ", backlog " + std::to_string(backlog), "ns/op", stopwatch.ElapsedNs() / (backlog + movesCount));
+      }
+
+      slowLocator->Stop();
+      fastLocator->Stop();
+   }
+}
+
+/// <summary>
+/// Measures DataManager's subscription cost depending on a backlog depth which is kept by a slow locator.
+/// The key keeps a short history, the first subscription with a replay and a subscription from now are measured,
+/// the both costs are expected to be flat regardless of the backlog depth (the replay walks the history only).
+/// </summary>
+/// <param name="storageName">A storage policy name for the report</param>
+template <typename StoragePolicy>
+void BenchSubscribeBacklog(const std::string& storageName)
+{
+   MQP::RetentionSettings retention;
+   retention.historyCount = 10;
+
+   for (const std::size_t backlog : { 0, 1'000, 100'000, 1'000'000 })
+   {
+      auto dataManager = std::make_shared<MQP::DataManager<int, int, StoragePolicy>>(0, retention);
+      auto consumer = std::make_shared<details::NullValueSourceConsumer<int, int>>();
+
+      auto slowLocator = dataManager->CreateValueSource(consumer);
+
+      for (std::size_t i = 0; i < backlog + retention.historyCount; ++i)
+      {
+         dataManager->AddValue(static_cast<int>(i));
+      }
+
+      const auto parameters = storageName + ", history 10, backlog " + std::to_string(backlog);
+
+      {
+         Stopwatch stopwatch;
+         auto locator = dataManager->CreateValueSource(consumer, { MQP::EStartPosition::lastN, 5 });
+         Report("Subscribe (first replay)", parameters, "ns/op", stopwatch.ElapsedNs());
+
+         locator->Stop();
+      }
+
+      {
+         Stopwatch stopwatch;
+         auto locator = dataManager->CreateValueSource(consumer);
+         Report("Subscribe (now)", parameters, "ns/op", stopwatch.ElapsedNs());
+
+         locator->Stop();
+      }
+
+      slowLocator->Stop();
+   }
+}
+
+/// <summary>
+/// Measures DataManagerFavorSpeed's AddValue cost for many locators and large values, and the locators' draining cost.
+/// PayloadCopied copies a value per locator, PayloadShared keeps a single copy which the locators reference,
+/// so the latter's adding cost is expected not to grow with the value size.
+/// </summary>
+/// <param name="payloadName">A payload policy name for the report</param>
+template <typename PayloadPolicy>
+void BenchFanOut(const std::string& payloadName)
+{
+   constexpr std::size_t roundsCount = 100;
+   constexpr std::size_t valuesPerRound = 100; // the values are drained after each round, so the copies fit the memory
+   constexpr std::size_t locatorsCount = 50;
+
+   struct LargeValue
+   {
+      std::array<char, 4096> payload{};
+   };
+
+   auto dataManager = std::make_shared<MQP::DataManagerFavorSpeed<int, LargeValue, MQP::NoTracer, PayloadPolicy>>(0);
+   auto consumer = std::make_shared<details::NullValueSourceConsumer<int, LargeValue>>();
+
+   std::vector<MQP::IValueSourcePtr<int, LargeValue>> locators;
+   for (std::size_t i = 0; i < locatorsCount; ++i)
+   {
+      locators.emplace_back(dataManager->CreateValueSource(consumer));
+   }
+
+   const LargeValue value;
+   double addNs = 0;
+   double drainNs = 0;
+
+   for (std::size_t round = 0; round < roundsCount; ++round)
+   {
+      {
+         Stopwatch stopwatch;
+         for (std::size_t i = 0; i < valuesPerRound; ++i)
+         {
+            dataManager->AddValue(value);
+         }
+
+         addNs += stopwatch.ElapsedNs();
+      }
+
+      {
+         Stopwatch stopwatch;
+         for (const auto& locator : locators)
+         {
+            while (locator->HasValue())
+            {
+               locator->GetValue();
+               locator->MoveNext();
+            }
+         }
+
+         drainNs += stopwatch.ElapsedNs();
+      }
+   }
+
+   for (const auto& locator : locators)
+   {
+      locator->Stop();
+   }
+
+   const auto parameters = payloadName + ", 50 locators, 4 KB values";
+   Report("AddValue fan-out", parameters, "ns/op", addNs / (roundsCount * valuesPerRound));
+   Report("AddValue fan-out", parameters, "drain ns/value", drainNs / (roundsCount * valuesPerRound * locatorsCount));
+}
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MultiQueueProcessor.h"
+#include "ThreadPoolBoost.h"
+#include "Bench.h"
+
+namespace MQPBench
+{
+
+/// <summary>
+/// Measures MultiQueueProcessor::GetStats duration for many keys, while a producer keeps enqueuing values.
+/// </summary>
+template <MQP::ETuning TUNING>
+void BenchStats(const std::string& tuningName)
+{
+   constexpr int keysCount = 100'000;
+   constexpr int consumersCount = 16;
+   constexpr std::size_t pollsCount = 10;
+
+   auto threadPool = std::make_shared<MQP::ThreadPoolBoost>();
+
+   MQP::MultiQueueProcessor<int, int, MQP::ThreadPoolBoost, TUNING> processor(threadPool);
+
+   struct NullConsumer : MQP::IConsumer<int, int>
+   {
+      void Consume(const int& /*key*/, const int& /*value*/) noexcept override
+      {}
+   };
+
+   std::vector<std::shared_ptr<NullConsumer>> consumers;
+   for (int i = 0; i < consumersCount; ++i)
+   {
+      consumers.emplace_back(std::make_shared<NullConsumer>());
+   }
+
+   for (int key = 0; key < keysCount; ++key)
+   {
+      processor.Subscribe(key, consumers[key % consumersCount]);
+   }
+
+   std::atomic_bool isStopRequested = false;
+   std::thread producer([&]()
+      {
+         for (int i = 0; !isStopRequested.load(std::memory_order_relaxed); ++i)
+         {
+            processor.Enqueue(i % keysCount, i);
+         }
+      });
+
+   std::vector<double> pollDurations;
+   for (std::size_t i = 0; i < pollsCount; ++i)
+   {
+      Stopwatch stopwatch;
+      const auto stats = processor.GetStats();
+      pollDurations.emplace_back(stopwatch.ElapsedNs());
+   }
+
+   isStopRequested.store(true);
+   producer.join();
+
+   for (int key = 0; key < keysCount; ++key)
+   {
+      processor.Unsubscribe(key, consumers[key % consumersCount]);
+   }
+
+   threadPool->Stop();
+
+   Report("GetStats", tuningName + ", 100000 keys", "p50 ms", Percentile(pollDurations, 50) / 1e6);
+   Report("GetStats", tuningName + ", 100000 keys", "max ms", Percentile(pollDurations, 100) / 1e6);
+}
+
+}
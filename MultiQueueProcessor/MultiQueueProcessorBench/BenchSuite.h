@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MultiQueueProcessor.h"
+#include "ThreadPoolBoost.h"
+#include "Bench.h"
+
+namespace MQPBench
+{
+
+/// <summary>
+/// The suite's parameters, every combination of them is measured
+/// </summary>
+struct SuiteSettings
+{
+   // counts of producer threads
+   std::vector<std::size_t> producersCounts;
+   // counts of consumers, keys are split between them (or shared if there are less keys than consumers)
+   std::vector<std::size_t> consumersCounts;
+   // counts of keys
+   std::vector<std::size_t> keysCounts = { 1, 1'000, 1'000'000 };
+   // count of values enqueued by all producers in a run
+   std::size_t valuesCount = 200'000;
+   // every n-th consumed value is sampled for the latency
+   std::size_t latencySamplingPeriod = 16;
+   // the latency tuning preallocates a ring per key, a run whose rings exceed the memory is skipped
+   std::size_t maxRingsMemory = std::size_t{ 256 } << 20;
+};
+
+/// <summary>
+/// Makes the default suite's settings: 1..N producers and consumers, where N is the hardware concurrency
+/// </summary>
+inline SuiteSettings MakeDefaultSuiteSettings()
+{
+   const std::size_t n = std::max(2u, std::thread::hardware_concurrency());
+
+   SuiteSettings settings;
+   settings.producersCounts = { 1, n };
+   settings.consumersCounts = { 1, n };
+   return settings;
+}
+
+/// <summary>
+/// A small value, just the enqueuing time (steady clock ticks)
+/// </summary>
+struct SmallValue
+{
+   std::int64_t enqueueTime = 0;
+};
+
+/// <summary>
+/// A large value, the enqueuing time and a payload which is copied with the value
+/// </summary>
+struct LargeValue
+{
+   std::int64_t enqueueTime = 0;
+   std::array<char, 1024> payload{};
+};
+
+namespace details
+{
+
+inline std::int64_t Now()
+{
+   return static_cast<std::int64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+}
+
+/// <summary>
+/// The consumer counts consumed values and keeps latencies (from Enqueue till Consume) of sampled ones.
+/// The consumer's calls are serialized by its ConsumerProcessor, so the samples are not guarded.
+/// </summary>
+template <typename Value>
+struct SuiteConsumer : MQP::IConsumer<std::uint32_t, Value>
+{
+   explicit SuiteConsumer(std::size_t latencySamplingPeriod) : samplingPeriod(latencySamplingPeriod)
+   {}
+
+   void Consume(const std::uint32_t& /*key*/, const Value& value) noexcept override
+   {
+      if (++callsCount % samplingPeriod == 0)
+      {
+         latencies.emplace_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::duration(Now() - value.enqueueTime)).count());
+      }
+
+      consumed.fetch_add(1, std::memory_order_release);
+   }
+
+   const std::size_t samplingPeriod;
+   std::size_t callsCount = 0;
+   std::vector<double> latencies; // ns
+   std::atomic_size_t consumed = 0;
+};
+
+}
+
+/// <summary>
+/// Measures the throughput (consumed values per second) and the latency of a MultiQueueProcessor under a load:
+/// the producers enqueue the values for the keys round-robin as fast as they can, while the consumers drain them.
+/// </summary>
+/// <param name="tuningName">The tuning's name for the report</param>
+/// <param name="valueName">The value type's name for the report</param>
+template <MQP::ETuning TUNING, typename Value>
+void BenchSuiteRun(const std::string& tuningName, const std::string& valueName,
+   std::size_t producersCount, std::size_t consumersCount, std::size_t keysCount, const SuiteSettings& settings)
+{
+   using Consumer = details::SuiteConsumer<Value>;
+
+   auto threadPool = std::make_shared<MQP::ThreadPoolBoost>();
+
+   MQP::MultiQueueProcessor<std::uint32_t, Value, MQP::ThreadPoolBoost, TUNING> processor(threadPool);
+
+   std::vector<std::shared_ptr<Consumer>> consumers;
+   for (std::size_t i = 0; i < consumersCount; ++i)
+   {
+      consumers.emplace_back(std::make_shared<Consumer>(settings.latencySamplingPeriod));
+   }
+
+   // a key's subscribers count, so the expected count of consumer calls is known
+   std::vector<std::uint32_t> subscribersCounts(keysCount, 0);
+   if (keysCount >= consumersCount)
+   {
+      for (std::size_t key = 0; key < keysCount; ++key)
+      {
+         processor.Subscribe(static_cast<std::uint32_t>(key), consumers[key % consumersCount]);
+         ++subscribersCounts[key];
+      }
+   }
+   else
+   {
+      for (std::size_t i = 0; i < consumersCount; ++i)
+      {
+         processor.Subscribe(static_cast<std::uint32_t>(i % keysCount), consumers[i]);
+         ++subscribersCounts[i % keysCount];
+      }
+   }
+
+   const auto valuesPerProducer = settings.valuesCount / producersCount;
+
+   std::size_t expectedCallsCount = 0;
+   for (std::size_t producer = 0; producer < producersCount; ++producer)
+   {
+      for (std::size_t i = 0; i < valuesPerProducer; ++i)
+      {
+         expectedCallsCount += subscribersCounts[(producer + i * producersCount) % keysCount];
+      }
+   }
+
+   std::atomic_bool isStarted = false;
+
+   std::vector<std::thread> producers;
+   for (std::size_t producer = 0; producer < producersCount; ++producer)
+   {
+      producers.emplace_back([&, producer]()
+         {
+            while (!isStarted.load(std::memory_order_acquire))
+            {
+               std::this_thread::yield();
+            }
+
+            Value value;
+            for (std::size_t i = 0; i < valuesPerProducer; ++i)
+            {
+               value.enqueueTime = details::Now();
+               processor.Enqueue(static_cast<std::uint32_t>((producer + i * producersCount) % keysCount), value);
+            }
+         });
+   }
+
+   Stopwatch stopwatch;
+   isStarted.store(true, std::memory_order_release);
+
+   for (auto& producer : producers)
+   {
+      producer.join();
+   }
+
+   const auto enqueueNs = stopwatch.ElapsedNs();
+
+   auto consumedCount = [&consumers]()
+   {
+      std::size_t count = 0;
+      for (const auto& consumer : consumers)
+      {
+         count += consumer->consumed.load(std::memory_order_acquire);
+      }
+
+      return count;
+   };
+
+   while (consumedCount() != expectedCallsCount)
+   {
+      std::this_thread::yield();
+   }
+
+   const auto elapsedNs = stopwatch.ElapsedNs();
+
+   threadPool->Stop();
+
+   std::vector<double> latencies;
+   for (const auto& consumer : consumers)
+   {
+      latencies.insert(std::end(latencies), std::begin(consumer->latencies), std::end(consumer->latencies));
+   }
+
+   const auto parameters = tuningName + " tuning, " + valueName + " values, " + std::to_string(producersCount) + " producers, "
+      + std::to_string(consumersCount) + " consumers, " + std::to_string(keysCount) + " keys";
+
+   Report("Suite", parameters, "enqueue values/s", valuesPerProducer * producersCount / enqueueNs * 1e9);
+   Report("Suite", parameters, "consume values/s", expectedCallsCount / elapsedNs * 1e9);
+   Report("Suite", parameters, "latency p50 ns", Percentile(latencies, 50));
+   Report("Suite", parameters, "latency p99 ns", Percentile(latencies, 99));
+}
+
+/// <summary>
+/// Runs the suite for every combination of the settings' producers, consumers and keys counts
+/// </summary>
+template <MQP::ETuning TUNING, typename Value>
+void BenchSuite(const std::string& tuningName, const std::string& valueName, const SuiteSettings& settings)
+{
+   for (const auto producersCount : settings.producersCounts)
+   {
+      for (const auto consumersCount : settings.consumersCounts)
+      {
+         for (const auto keysCount : settings.keysCounts)
+         {
+            if (TUNING == MQP::ETuning::latency && keysCount * MQP::defaultRingCapacity * sizeof(Value) > settings.maxRingsMemory)
+            {
+               continue;
+            }
+
+            BenchSuiteRun<TUNING, Value>(tuningName, valueName, producersCount, consumersCount, keysCount, settings);
+         }
+      }
+   }
+}
+
+/// <summary>
+/// Runs the suite for every data management strategy and both small and large values
+/// </summary>
+inline void BenchSuite(const SuiteSettings& settings)
+{
+   BenchSuite<MQP::ETuning::size, SmallValue>("size", "small", settings);
+   BenchSuite<MQP::ETuning::size, LargeValue>("size", "large", settings);
+   BenchSuite<MQP::ETuning::speed, SmallValue>("speed", "small", settings);
+   BenchSuite<MQP::ETuning::speed, LargeValue>("speed", "large", settings);
+   BenchSuite<MQP::ETuning::latency, SmallValue>("latency", "small", settings);
+   BenchSuite<MQP::ETuning::latency, LargeValue>("latency", "large", settings);
+   BenchSuite<MQP::ETuning::share, SmallValue>("share", "small", settings);
+   BenchSuite<MQP::ETuning::share, LargeValue>("share", "large", settings);
+}
+
+}
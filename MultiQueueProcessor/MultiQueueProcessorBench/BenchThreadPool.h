@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MultiQueueProcessor.h"
+#include "Bench.h"
+
+namespace MQPBench
+{
+
+namespace details
+{
+
+/// <summary>
+/// The consumer updates its own working set (a few KB) per value, like a consumer which keeps a per-key state
+/// </summary>
+template <typename Key, typename Value>
+struct WorkingSetConsumer : MQP::IConsumer<Key, Value>
+{
+   void Consume(const Key& /*key*/, const Value& value) noexcept override
+   {
+      for (std::size_t i = static_cast<std::size_t>(value) % stride; i < workingSet.size(); i += stride)
+      {
+         ++workingSet[i];
+      }
+
+      consumed.fetch_add(1, std::memory_order_release);
+   }
+
+   static constexpr std::size_t stride = 16; // a cache line of std::uint32_t values
+
+   std::array<std::uint32_t, 4096> workingSet{};
+   std::atomic_size_t consumed = 0;
+};
+
+}
+
+/// <summary>
+/// Measures the consumers throughput for a thread pool.
+/// A consumer per key, the values are enqueued by a few producers, each consumer keeps its own working set.
+/// </summary>
+/// <param name="poolName">A thread pool name for the report</param>
+template <typename TPool>
+void BenchThreadPool(const std::string& poolName)
+{
+   constexpr int keysCount = 64;
+   constexpr std::size_t valuesPerKey = 20'000;
+   constexpr int producersCount = 4;
+
+   auto threadPool = std::make_shared<TPool>();
+
+   MQP::MultiQueueProcessorSettings settings;
+   settings.consumerProcessorSettings.drainQuantumCount = 16;
+
+   MQP::MultiQueueProcessor<int, int, TPool, MQP::ETuning::size> processor(threadPool, settings);
+
+   std::vector<std::shared_ptr<details::WorkingSetConsumer<int, int>>> consumers;
+   for (int key = 0; key < keysCount; ++key)
+   {
+      consumers.emplace_back(std::make_shared<details::WorkingSetConsumer<int, int>>());
+      processor.Subscribe(key, consumers.back());
+   }
+
+   Stopwatch stopwatch;
+
+   std::vector<std::thread> producers;
+   for (int producer = 0; producer < producersCount; ++producer)
+   {
+      producers.emplace_back([&processor, producer]()
+         {
+            for (std::size_t i = producer; i < valuesPerKey * keysCount; i += producersCount)
+            {
+               processor.Enqueue(static_cast<int>(i % keysCount), static_cast<int>(i));
+            }
+         });
+   }
+
+   for (auto& producer : producers)
+   {
+      producer.join();
+   }
+
+   for (const auto& consumer : consumers)
+   {
+      while (consumer->consumed.load(std::memory_order_acquire) != valuesPerKey)
+      {
+         std::this_thread::yield();
+      }
+   }
+
+   Report("Thread pool throughput", poolName + ", " + std::to_string(keysCount) + " keys", "ns/value", stopwatch.ElapsedNs() / (valuesPerKey * keysCount));
+
+   for (int key = 0; key < keysCount; ++key)
+   {
+      processor.Unsubscribe(key, consumers[key]);
+   }
+
+   threadPool->Stop();
+}
+
+}
@@ -0,0 +1,126 @@
+// The file runs MultiQueueProcessor's benchmarks
+//
+// Usage: mqp_bench [--json <file>] [--suite-only] [--values <count>] [--max-keys <count>]
+//    --json <file>       writes all results to the file as JSON (see MQPBench::WriteJson)
+//    --suite-only        runs the producers/consumers/keys/values suite only (see MQPBench::BenchSuite)
+//    --values <count>    count of values enqueued in a suite run
+//    --max-keys <count>  the greatest keys count of the suite
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "BenchConflation.h"
+#include "BenchDataManager.h"
+#include "BenchConsumerProcessor.h"
+#include "BenchStats.h"
+#include "BenchSuite.h"
+#include "BenchThreadPool.h"
+#include "ThreadPoolBoost.h"
+#include "ThreadPoolSticky.h"
+#include "ThreadPoolWorkStealing.h"
+
+namespace
+{
+
+void RunComponentBenchmarks()
+{
+   MQPBench::BenchMoveNextBacklog<MQP::StorageSegmented<>>("segmented storage");
+   MQPBench::BenchMoveNextBacklog<MQP::StorageList>("list storage");
+   MQPBench::BenchSubscribeBacklog<MQP::StorageSegmented<>>("segmented storage");
+   MQPBench::BenchSubscribeBacklog<MQP::StorageList>("list storage");
+   MQPBench::BenchFanOut<MQP::PayloadCopied>("copied payload");
+   MQPBench::BenchFanOut<MQP::PayloadShared>("shared payload");
+
+   MQPBench::BenchDrainQuantum();
+   MQPBench::BenchBatchConsumer<MQP::ETuning::size>("size tuning");
+   MQPBench::BenchBatchConsumer<MQP::ETuning::speed>("speed tuning");
+   MQPBench::BenchBatchConsumer<MQP::ETuning::latency>("latency tuning");
+   MQPBench::BenchBatchConsumer<MQP::ETuning::share>("share tuning");
+   MQPBench::BenchTaskAllocations();
+   MQPBench::BenchSteadyStateAllocations<MQP::ETuning::size>("size tuning");
+   MQPBench::BenchSteadyStateAllocations<MQP::ETuning::speed>("speed tuning");
+   MQPBench::BenchSteadyStateAllocations<MQP::ETuning::latency>("latency tuning");
+   MQPBench::BenchInstrumentation<MQP::NoInstrumentation>("no instrumentation");
+   MQPBench::BenchInstrumentation<MQP::LatencyInstrumentation>("latency instrumentation");
+   MQPBench::BenchTracer<MQP::NoTracer>("no tracer");
+   MQPBench::BenchTracer<MQP::ChromeTracer<4096>>("chrome tracer, 4096 events per thread");
+
+   MQPBench::BenchStats<MQP::ETuning::size>("size tuning");
+   MQPBench::BenchStats<MQP::ETuning::speed>("speed tuning");
+
+   MQPBench::BenchConflation<MQP::ETuning::speed>("speed tuning");
+   MQPBench::BenchConflation<MQP::ETuning::conflate>("conflate tuning");
+
+   MQPBench::BenchThreadPool<MQP::ThreadPoolBoost>("boost");
+   MQPBench::BenchThreadPool<MQP::ThreadPoolSticky>("sticky");
+   MQPBench::BenchThreadPool<MQP::ThreadPoolWorkStealing>("work stealing");
+
+   const MQP::ThreadPoolIdlePolicy spinningPolicy{ std::chrono::microseconds(50) };
+
+   MQPBench::BenchNotificationLatency("boost", std::make_shared<MQP::ThreadPoolBoost>());
+   MQPBench::BenchNotificationLatency("boost, inline dispatch", std::make_shared<MQP::ThreadPoolBoost>(), true);
+   MQPBench::BenchNotificationLatency("sticky, parking", std::make_shared<MQP::ThreadPoolSticky>());
+   MQPBench::BenchNotificationLatency("sticky, spinning 50 us", std::make_shared<MQP::ThreadPoolSticky>(std::thread::hardware_concurrency(), spinningPolicy));
+   MQPBench::BenchNotificationLatency("work stealing, parking", std::make_shared<MQP::ThreadPoolWorkStealing>());
+   MQPBench::BenchNotificationLatency("work stealing, spinning 50 us", std::make_shared<MQP::ThreadPoolWorkStealing>(std::thread::hardware_concurrency(), spinningPolicy));
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+   std::string jsonPath;
+   bool isSuiteOnly = false;
+   auto suiteSettings = MQPBench::MakeDefaultSuiteSettings();
+
+   for (int i = 1; i < argc; ++i)
+   {
+      const bool hasValue = i + 1 < argc;
+      if (std::strcmp(argv[i], "--json") == 0 && hasValue)
+      {
+         jsonPath = argv[++i];
+      }
+      else if (std::strcmp(argv[i], "--suite-only") == 0)
+      {
+         isSuiteOnly = true;
+      }
+      else if (std::strcmp(argv[i], "--values") == 0 && hasValue)
+      {
+         suiteSettings.valuesCount = std::stoul(argv[++i]);
+      }
+      else if (std::strcmp(argv[i], "--max-keys") == 0 && hasValue)
+      {
+         const auto maxKeysCount = std::stoul(argv[++i]);
+         auto& keysCounts = suiteSettings.keysCounts;
+         keysCounts.erase(std::remove_if(std::begin(keysCounts), std::end(keysCounts), [maxKeysCount](auto count) { return count > maxKeysCount; }), std::end(keysCounts));
+      }
+      else
+      {
+         std::cerr << "Usage: " << argv[0] << " [--json <file>] [--suite-only] [--values <count>] [--max-keys <count>]" << std::endl;
+         return 1;
+      }
+   }
+
+   if (!isSuiteOnly)
+   {
+      RunComponentBenchmarks();
+   }
+
+   MQPBench::BenchSuite(suiteSettings);
+
+   if (!jsonPath.empty())
+   {
+      std::ofstream json(jsonPath);
+      MQPBench::WriteJson(json);
+      if (!json)
+      {
+         std::cerr << "Failed to write " << jsonPath << std::endl;
+         return 1;
+      }
+   }
+
+   return 0;
+}